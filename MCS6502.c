@@ -7,7 +7,9 @@
 //  in the documenation of binary redistributions. See accompanying LICENSE.TXT.
 //
 
+#include <stdlib.h>
 #include <string.h>
+#include <limits.h>
 #include "MCS6502.h"
 
 // If you uncomment the below and rebuild, you'll get a stream of
@@ -45,163 +47,181 @@ typedef struct _MCS6502Instruction {
     bool timingAddOne;
 } MCS6502Instruction;
 
+// The instruction set is described once, in the list below, as
+// X(opcode, mnemonic, addressing mode, timing, timingAddOne) entries. It is expanded
+// into the MCS6502Instructions table (used for decoding and disassembly) and into the
+// per-opcode handler functions further down.
+#define MCS6502_INSTRUCTION_LIST(X) \
+    X(0x69, ADC, Immediate, 2, false)   \
+    X(0x65, ADC, ZeroPage, 3, false)    \
+    X(0x75, ADC, ZeroPageX, 4, false)   \
+    X(0x6D, ADC, Absolute, 4, false)    \
+    X(0x7D, ADC, AbsoluteX, 4, true)    \
+    X(0x79, ADC, AbsoluteY, 4, true)    \
+    X(0x61, ADC, XIndirect, 6, false)   \
+    X(0x71, ADC, IndirectY, 5, true)    \
+    X(0x29, AND, Immediate, 2, false)   \
+    X(0x25, AND, ZeroPage, 3, false)    \
+    X(0x35, AND, ZeroPageX, 4, false)   \
+    X(0x2D, AND, Absolute, 4, false)    \
+    X(0x3D, AND, AbsoluteX, 4, true)    \
+    X(0x39, AND, AbsoluteY, 4, true)    \
+    X(0x21, AND, XIndirect, 6, false)   \
+    X(0x31, AND, IndirectY, 5, true)    \
+    X(0x0A, ASL, Accumulator, 2, false) \
+    X(0x06, ASL, ZeroPage, 5, false)    \
+    X(0x16, ASL, ZeroPageX, 6, false)   \
+    X(0x0E, ASL, Absolute, 6, false)    \
+    X(0x1E, ASL, AbsoluteX, 7, false)   \
+    X(0x90, BCC, Relative, 0, true)     \
+    X(0xB0, BCS, Relative, 0, true)     \
+    X(0xF0, BEQ, Relative, 0, true)     \
+    X(0x24, BIT, ZeroPage, 3, false)    \
+    X(0x2C, BIT, Absolute, 4, false)    \
+    X(0x30, BMI, Relative, 0, true)     \
+    X(0xD0, BNE, Relative, 0, true)     \
+    X(0x10, BPL, Relative, 0, true)     \
+    X(0x00, BRK, Implied, 7, false)     \
+    X(0x50, BVC, Relative, 0, true)     \
+    X(0x70, BVS, Relative, 0, true)     \
+    X(0x18, CLC, Implied, 2, false)     \
+    X(0xD8, CLD, Implied, 2, false)     \
+    X(0x58, CLI, Implied, 2, false)     \
+    X(0xB8, CLV, Implied, 2, false)     \
+    X(0xC9, CMP, Immediate, 2, false)   \
+    X(0xC5, CMP, ZeroPage, 3, false)    \
+    X(0xD5, CMP, ZeroPageX, 4, false)   \
+    X(0xCD, CMP, Absolute, 4, false)    \
+    X(0xDD, CMP, AbsoluteX, 4, true)    \
+    X(0xD9, CMP, AbsoluteY, 4, true)    \
+    X(0xC1, CMP, XIndirect, 6, false)   \
+    X(0xD1, CMP, IndirectY, 5, true)    \
+    X(0xE0, CPX, Immediate, 2, false)   \
+    X(0xE4, CPX, ZeroPage, 3, false)    \
+    X(0xEC, CPX, Absolute, 4, false)    \
+    X(0xC0, CPY, Immediate, 3, false)   \
+    X(0xC4, CPY, ZeroPage, 3, false)    \
+    X(0xCC, CPY, Absolute, 4, false)    \
+    X(0xC6, DEC, ZeroPage, 5, false)    \
+    X(0xD6, DEC, ZeroPageX, 6, false)   \
+    X(0xCE, DEC, Absolute, 6, false)    \
+    X(0xDE, DEC, AbsoluteX, 7, false)   \
+    X(0xCA, DEX, Implied, 2, false)     \
+    X(0x88, DEY, Implied, 2, false)     \
+    X(0x49, EOR, Immediate, 2, false)   \
+    X(0x45, EOR, ZeroPage, 3, false)    \
+    X(0x55, EOR, ZeroPageX, 4, false)   \
+    X(0x4D, EOR, Absolute, 4, false)    \
+    X(0x5D, EOR, AbsoluteX, 4, true)    \
+    X(0x59, EOR, AbsoluteY, 4, true)    \
+    X(0x41, EOR, XIndirect, 6, false)   \
+    X(0x51, EOR, IndirectY, 5, true)    \
+    X(0xE6, INC, ZeroPage, 5, false)    \
+    X(0xF6, INC, ZeroPageX, 6, false)   \
+    X(0xEE, INC, Absolute, 6, false)    \
+    X(0xFE, INC, AbsoluteX, 7, false)   \
+    X(0xE8, INX, Implied, 2, false)     \
+    X(0xC8, INY, Implied, 2, false)     \
+    X(0x4C, JMP, Absolute, 3, false)    \
+    X(0x6C, JMP, Indirect, 5, false)    \
+    X(0x20, JSR, Absolute, 6, false)    \
+    X(0xA9, LDA, Immediate, 2, false)   \
+    X(0xA5, LDA, ZeroPage, 3, false)    \
+    X(0xB5, LDA, ZeroPageX, 4, false)   \
+    X(0xAD, LDA, Absolute, 4, false)    \
+    X(0xBD, LDA, AbsoluteX, 4, true)    \
+    X(0xB9, LDA, AbsoluteY, 4, true)    \
+    X(0xA1, LDA, XIndirect, 6, false)   \
+    X(0xB1, LDA, IndirectY, 5, true)    \
+    X(0xA2, LDX, Immediate, 2, false)   \
+    X(0xA6, LDX, ZeroPage, 3, false)    \
+    X(0xB6, LDX, ZeroPageY, 4, false)   \
+    X(0xAE, LDX, Absolute, 4, false)    \
+    X(0xBE, LDX, AbsoluteY, 4, true)    \
+    X(0xA0, LDY, Immediate, 2, false)   \
+    X(0xA4, LDY, ZeroPage, 3, false)    \
+    X(0xB4, LDY, ZeroPageX, 4, false)   \
+    X(0xAC, LDY, Absolute, 4, false)    \
+    X(0xBC, LDY, AbsoluteX, 4, true)    \
+    X(0x4A, LSR, Accumulator, 2, false) \
+    X(0x46, LSR, ZeroPage, 5, false)    \
+    X(0x56, LSR, ZeroPageX, 6, false)   \
+    X(0x4E, LSR, Absolute, 6, false)    \
+    X(0x5E, LSR, AbsoluteX, 7, false)   \
+    X(0xEA, NOP, Implied, 2, false)     \
+    X(0x09, ORA, Immediate, 2, false)   \
+    X(0x05, ORA, ZeroPage, 3, false)    \
+    X(0x15, ORA, ZeroPageX, 4, false)   \
+    X(0x0D, ORA, Absolute, 4, false)    \
+    X(0x1D, ORA, AbsoluteX, 4, true)    \
+    X(0x19, ORA, AbsoluteY, 4, true)    \
+    X(0x01, ORA, XIndirect, 6, false)   \
+    X(0x11, ORA, IndirectY, 5, true)    \
+    X(0x48, PHA, Implied, 3, false)     \
+    X(0x08, PHP, Implied, 3, false)     \
+    X(0x68, PLA, Implied, 4, false)     \
+    X(0x28, PLP, Implied, 4, false)     \
+    X(0x2A, ROL, Accumulator, 2, false) \
+    X(0x26, ROL, ZeroPage, 5, false)    \
+    X(0x36, ROL, ZeroPageX, 6, false)   \
+    X(0x2E, ROL, Absolute, 6, false)    \
+    X(0x3E, ROL, AbsoluteX, 7, false)   \
+    X(0x6A, ROR, Accumulator, 2, false) \
+    X(0x66, ROR, ZeroPage, 5, false)    \
+    X(0x76, ROR, ZeroPageX, 6, false)   \
+    X(0x6E, ROR, Absolute, 6, false)    \
+    X(0x7E, ROR, AbsoluteX, 7, false)   \
+    X(0x40, RTI, Implied, 6, false)     \
+    X(0x60, RTS, Implied, 6, false)     \
+    X(0xE9, SBC, Immediate, 2, false)   \
+    X(0xE5, SBC, ZeroPage, 3, false)    \
+    X(0xF5, SBC, ZeroPageX, 4, false)   \
+    X(0xED, SBC, Absolute, 4, false)    \
+    X(0xFD, SBC, AbsoluteX, 4, true)    \
+    X(0xF9, SBC, AbsoluteY, 4, true)    \
+    X(0xE1, SBC, XIndirect, 6, false)   \
+    X(0xF1, SBC, IndirectY, 5, true)    \
+    X(0x38, SEC, Implied, 2, false)     \
+    X(0xF8, SED, Implied, 2, false)     \
+    X(0x78, SEI, Implied, 2, false)     \
+    X(0x85, STA, ZeroPage, 3, false)    \
+    X(0x95, STA, ZeroPageX, 4, false)   \
+    X(0x8D, STA, Absolute, 4, false)    \
+    X(0x9D, STA, AbsoluteX, 5, false)   \
+    X(0x99, STA, AbsoluteY, 5, false)   \
+    X(0x81, STA, XIndirect, 6, false)   \
+    X(0x91, STA, IndirectY, 6, false)   \
+    X(0x86, STX, ZeroPage, 3, false)    \
+    X(0x96, STX, ZeroPageY, 4, false)   \
+    X(0x8E, STX, Absolute, 4, false)    \
+    X(0x84, STY, ZeroPage, 3, false)    \
+    X(0x94, STY, ZeroPageX, 4, false)   \
+    X(0x8C, STY, Absolute, 4, false)    \
+    X(0xAA, TAX, Implied, 2, false)     \
+    X(0xA8, TAY, Implied, 2, false)     \
+    X(0xBA, TSX, Implied, 2, false)     \
+    X(0x8A, TXA, Implied, 2, false)     \
+    X(0x9A, TXS, Implied, 2, false)     \
+    X(0x98, TYA, Implied, 2, false)
+
 MCS6502Instruction MCS6502Instructions[] = {
-    {0x69, "ADC", MCS6502AddressingImmediate, 2, false},
-    {0x65, "ADC", MCS6502AddressingZeroPage, 3, false},
-    {0x75, "ADC", MCS6502AddressingZeroPageX, 4, false},
-    {0x6D, "ADC", MCS6502AddressingAbsolute, 4, false},
-    {0x7D, "ADC", MCS6502AddressingAbsoluteX, 4, true},
-    {0x79, "ADC", MCS6502AddressingAbsoluteY, 4, true},
-    {0x61, "ADC", MCS6502AddressingXIndirect, 6, false},
-    {0x71, "ADC", MCS6502AddressingIndirectY, 5, true},
-    {0x29, "AND", MCS6502AddressingImmediate, 2, false},
-    {0x25, "AND", MCS6502AddressingZeroPage, 3, false},
-    {0x35, "AND", MCS6502AddressingZeroPageX, 4, false},
-    {0x2D, "AND", MCS6502AddressingAbsolute, 4, false},
-    {0x3D, "AND", MCS6502AddressingAbsoluteX, 4, true},
-    {0x39, "AND", MCS6502AddressingAbsoluteY, 4, true},
-    {0x21, "AND", MCS6502AddressingXIndirect, 6, false},
-    {0x31, "AND", MCS6502AddressingIndirectY, 5, true},
-    {0x0A, "ASL", MCS6502AddressingAccumulator, 2, false},
-    {0x06, "ASL", MCS6502AddressingZeroPage, 5, false},
-    {0x16, "ASL", MCS6502AddressingZeroPageX, 6, false},
-    {0x0E, "ASL", MCS6502AddressingAbsolute, 6, false},
-    {0x1E, "ASL", MCS6502AddressingAbsoluteX, 7, false},
-    {0x90, "BCC", MCS6502AddressingRelative, 0, true},
-    {0xB0, "BCS", MCS6502AddressingRelative, 0, true},
-    {0xF0, "BEQ", MCS6502AddressingRelative, 0, true},
-    {0x24, "BIT", MCS6502AddressingZeroPage, 3, false},
-    {0x2C, "BIT", MCS6502AddressingAbsolute, 4, false},
-    {0x30, "BMI", MCS6502AddressingRelative, 0, true},
-    {0xD0, "BNE", MCS6502AddressingRelative, 0, true},
-    {0x10, "BPL", MCS6502AddressingRelative, 0, true},
-    {0x00, "BRK", MCS6502AddressingImplied, 7, false},
-    {0x50, "BVC", MCS6502AddressingRelative, 0, true},
-    {0x70, "BVS", MCS6502AddressingRelative, 0, true},
-    {0x18, "CLC", MCS6502AddressingImplied, 2, false},
-    {0xD8, "CLD", MCS6502AddressingImplied, 2, false},
-    {0x58, "CLI", MCS6502AddressingImplied, 2, false},
-    {0xB8, "CLV", MCS6502AddressingImplied, 2, false},
-    {0xC9, "CMP", MCS6502AddressingImmediate, 2, false},
-    {0xC5, "CMP", MCS6502AddressingZeroPage, 3, false},
-    {0xD5, "CMP", MCS6502AddressingZeroPageX, 4, false},
-    {0xCD, "CMP", MCS6502AddressingAbsolute, 4, false},
-    {0xDD, "CMP", MCS6502AddressingAbsoluteX, 4, true},
-    {0xD9, "CMP", MCS6502AddressingAbsoluteY, 4, true},
-    {0xC1, "CMP", MCS6502AddressingXIndirect, 6, false},
-    {0xD1, "CMP", MCS6502AddressingIndirectY, 5, true},
-    {0xE0, "CPX", MCS6502AddressingImmediate, 2, false},
-    {0xE4, "CPX", MCS6502AddressingZeroPage, 3, false},
-    {0xEC, "CPX", MCS6502AddressingAbsolute, 4, false},
-    {0xC0, "CPY", MCS6502AddressingImmediate, 3, false},
-    {0xC4, "CPY", MCS6502AddressingZeroPage, 3, false},
-    {0xCC, "CPY", MCS6502AddressingAbsolute, 4, false},
-    {0xC6, "DEC", MCS6502AddressingZeroPage, 5, false},
-    {0xD6, "DEC", MCS6502AddressingZeroPageX, 6, false},
-    {0xCE, "DEC", MCS6502AddressingAbsolute, 6, false},
-    {0xDE, "DEC", MCS6502AddressingAbsoluteX, 7, false},
-    {0xCA, "DEX", MCS6502AddressingImplied, 2, false},
-    {0x88, "DEY", MCS6502AddressingImplied, 2, false},
-    {0x49, "EOR", MCS6502AddressingImmediate, 2, false},
-    {0x45, "EOR", MCS6502AddressingZeroPage, 3, false},
-    {0x55, "EOR", MCS6502AddressingZeroPageX, 4, false},
-    {0x4D, "EOR", MCS6502AddressingAbsolute, 4, false},
-    {0x5D, "EOR", MCS6502AddressingAbsoluteX, 4, true},
-    {0x59, "EOR", MCS6502AddressingAbsoluteY, 4, true},
-    {0x41, "EOR", MCS6502AddressingXIndirect, 6, false},
-    {0x51, "EOR", MCS6502AddressingIndirectY, 5, true},
-    {0xE6, "INC", MCS6502AddressingZeroPage, 5, false},
-    {0xF6, "INC", MCS6502AddressingZeroPageX, 6, false},
-    {0xEE, "INC", MCS6502AddressingAbsolute, 6, false},
-    {0xFE, "INC", MCS6502AddressingAbsoluteX, 7, false},
-    {0xE8, "INX", MCS6502AddressingImplied, 2, false},
-    {0xC8, "INY", MCS6502AddressingImplied, 2, false},
-    {0x4C, "JMP", MCS6502AddressingAbsolute, 3, false},
-    {0x6C, "JMP", MCS6502AddressingIndirect, 5, false},
-    {0x20, "JSR", MCS6502AddressingAbsolute, 6, false},
-    {0xA9, "LDA", MCS6502AddressingImmediate, 2, false},
-    {0xA5, "LDA", MCS6502AddressingZeroPage, 3, false},
-    {0xB5, "LDA", MCS6502AddressingZeroPageX, 4, false},
-    {0xAD, "LDA", MCS6502AddressingAbsolute, 4, false},
-    {0xBD, "LDA", MCS6502AddressingAbsoluteX, 4, true},
-    {0xB9, "LDA", MCS6502AddressingAbsoluteY, 4, true},
-    {0xA1, "LDA", MCS6502AddressingXIndirect, 6, false},
-    {0xB1, "LDA", MCS6502AddressingIndirectY, 5, true},
-    {0xA2, "LDX", MCS6502AddressingImmediate, 2, false},
-    {0xA6, "LDX", MCS6502AddressingZeroPage, 3, false},
-    {0xB6, "LDX", MCS6502AddressingZeroPageY, 4, false},
-    {0xAE, "LDX", MCS6502AddressingAbsolute, 4, false},
-    {0xBE, "LDX", MCS6502AddressingAbsoluteY, 4, true},
-    {0xA0, "LDY", MCS6502AddressingImmediate, 2, false},
-    {0xA4, "LDY", MCS6502AddressingZeroPage, 3, false},
-    {0xB4, "LDY", MCS6502AddressingZeroPageX, 4, false},
-    {0xAC, "LDY", MCS6502AddressingAbsolute, 4, false},
-    {0xBC, "LDY", MCS6502AddressingAbsoluteX, 4, true},
-    {0x4A, "LSR", MCS6502AddressingAccumulator, 2, false},
-    {0x46, "LSR", MCS6502AddressingZeroPage, 5, false},
-    {0x56, "LSR", MCS6502AddressingZeroPageX, 6, false},
-    {0x4E, "LSR", MCS6502AddressingAbsolute, 6, false},
-    {0x5E, "LSR", MCS6502AddressingAbsoluteX, 7, false},
-    {0xEA, "NOP", MCS6502AddressingImplied, 2, false},
-    {0x09, "ORA", MCS6502AddressingImmediate, 2, false},
-    {0x05, "ORA", MCS6502AddressingZeroPage, 3, false},
-    {0x15, "ORA", MCS6502AddressingZeroPageX, 4, false},
-    {0x0D, "ORA", MCS6502AddressingAbsolute, 4, false},
-    {0x1D, "ORA", MCS6502AddressingAbsoluteX, 4, true},
-    {0x19, "ORA", MCS6502AddressingAbsoluteY, 4, true},
-    {0x01, "ORA", MCS6502AddressingXIndirect, 6, false},
-    {0x11, "ORA", MCS6502AddressingIndirectY, 5, true},
-    {0x48, "PHA", MCS6502AddressingImplied, 3, false},
-    {0x08, "PHP", MCS6502AddressingImplied, 3, false},
-    {0x68, "PLA", MCS6502AddressingImplied, 4, false},
-    {0x28, "PLP", MCS6502AddressingImplied, 4, false},
-    {0x2A, "ROL", MCS6502AddressingAccumulator, 2, false},
-    {0x26, "ROL", MCS6502AddressingZeroPage, 5, false},
-    {0x36, "ROL", MCS6502AddressingZeroPageX, 6, false},
-    {0x2E, "ROL", MCS6502AddressingAbsolute, 6, false},
-    {0x3E, "ROL", MCS6502AddressingAbsoluteX, 7, false},
-    {0x6A, "ROR", MCS6502AddressingAccumulator, 2, false},
-    {0x66, "ROR", MCS6502AddressingZeroPage, 5, false},
-    {0x76, "ROR", MCS6502AddressingZeroPageX, 6, false},
-    {0x6E, "ROR", MCS6502AddressingAbsolute, 6, false},
-    {0x7E, "ROR", MCS6502AddressingAbsoluteX, 7, false},
-    {0x40, "RTI", MCS6502AddressingImplied, 6, false},
-    {0x60, "RTS", MCS6502AddressingImplied, 6, false},
-    {0xE9, "SBC", MCS6502AddressingImmediate, 2, false},
-    {0xE5, "SBC", MCS6502AddressingZeroPage, 3, false},
-    {0xF5, "SBC", MCS6502AddressingZeroPageX, 4, false},
-    {0xED, "SBC", MCS6502AddressingAbsolute, 4, false},
-    {0xFD, "SBC", MCS6502AddressingAbsoluteX, 4, true},
-    {0xF9, "SBC", MCS6502AddressingAbsoluteY, 4, true},
-    {0xE1, "SBC", MCS6502AddressingXIndirect, 6, false},
-    {0xF1, "SBC", MCS6502AddressingIndirectY, 5, true},
-    {0x38, "SEC", MCS6502AddressingImplied, 2, false},
-    {0xF8, "SED", MCS6502AddressingImplied, 2, false},
-    {0x78, "SEI", MCS6502AddressingImplied, 2, false},
-    {0x85, "STA", MCS6502AddressingZeroPage, 3, false},
-    {0x95, "STA", MCS6502AddressingZeroPageX, 4, false},
-    {0x8D, "STA", MCS6502AddressingAbsolute, 4, false},
-    {0x9D, "STA", MCS6502AddressingAbsoluteX, 5, false},
-    {0x99, "STA", MCS6502AddressingAbsoluteY, 5, false},
-    {0x81, "STA", MCS6502AddressingXIndirect, 6, false},
-    {0x91, "STA", MCS6502AddressingIndirectY, 6, false},
-    {0x86, "STX", MCS6502AddressingZeroPage, 3, false},
-    {0x96, "STX", MCS6502AddressingZeroPageY, 4, false},
-    {0x8E, "STX", MCS6502AddressingAbsolute, 4, false},
-    {0x84, "STY", MCS6502AddressingZeroPage, 3, false},
-    {0x94, "STY", MCS6502AddressingZeroPageX, 4, false},
-    {0x8C, "STY", MCS6502AddressingAbsolute, 4, false},
-    {0xAA, "TAX", MCS6502AddressingImplied, 2, false},
-    {0xA8, "TAY", MCS6502AddressingImplied, 2, false},
-    {0xBA, "TSX", MCS6502AddressingImplied, 2, false},
-    {0x8A, "TXA", MCS6502AddressingImplied, 2, false},
-    {0x9A, "TXS", MCS6502AddressingImplied, 2, false},
-    {0x98, "TYA", MCS6502AddressingImplied, 2, false}
+#define MCS6502_INSTRUCTION_ENTRY(opcode, mnemonic, mode, timing, timingAddOne) \
+    {opcode, #mnemonic, MCS6502Addressing##mode, timing, timingAddOne},
+    MCS6502_INSTRUCTION_LIST(MCS6502_INSTRUCTION_ENTRY)
+#undef MCS6502_INSTRUCTION_ENTRY
 };
 // The above instructions are inserted into this indexed jump table the
 // first time someone calls init, below.
 static MCS6502Instruction *MCS6502OpcodeTable[256];
 
+// The per-opcode handlers rely on the compiler folding the addressing mode
+// switches away, which only happens if the helpers are really inlined.
+#if defined(__GNUC__) || defined(__clang__)
+#define MCS6502_ALWAYS_INLINE inline __attribute__((always_inline))
+#else
+#define MCS6502_ALWAYS_INLINE inline
+#endif
+
 //
 // Forward declarations of local private routines.
 //
@@ -212,19 +232,27 @@ static inline void PushByte(uint8 byte, MCS6502ExecutionContext *context);
 static inline void PushFlags(bool b, MCS6502ExecutionContext *context);
 static inline uint8 PullByte(MCS6502ExecutionContext *context);
 static inline uint16 ReadWordAtAddress(uint16 addr, MCS6502ExecutionContext *context);
-static inline uint8 BCDFromInteger(int integer);
-static inline int IntegerFromBCD(uint8 bcd);
 
 static void HandleIRQ(MCS6502ExecutionContext *context);
 static void HandleNMI(MCS6502ExecutionContext *context);
+static MCS6502ExecResult ExecNextInstruction(MCS6502ExecutionContext *context);
 
+static MCS6502_ALWAYS_INLINE uint16 FetchOperand(int length, MCS6502ExecutionContext *context);
+static MCS6502_ALWAYS_INLINE uint16 EffectiveOperandAddressForMode(MCS6502AddressingMode mode, uint16 operand,
+                                                                    MCS6502ExecutionContext *context,
+                                                                    bool *crossesPageBoundary);
+#ifdef MCS6502_REFERENCE_SWITCH
 static uint16 EffectiveOperandAddressForInstruction(MCS6502Instruction *instruction, MCS6502ExecutionContext *context,
                                                     bool *crossesPageBoundary);
 static uint8 ReadOperandValueForCurrentInstruction(MCS6502Instruction *instruction, MCS6502ExecutionContext *context);
 static void WriteResultForCurrentInstruction(uint8 result, MCS6502Instruction *instruction,
                                              MCS6502ExecutionContext *context);
+#endif
+static MCS6502_ALWAYS_INLINE int LengthForMode(MCS6502AddressingMode mode);
 static int LengthForInstruction(MCS6502Instruction *instruction);
+#ifdef MCS6502_REFERENCE_SWITCH
 static void ExecuteConditionalBranch(bool condition, MCS6502Instruction *instruction, MCS6502ExecutionContext *context);
+#endif
 
 //
 // Status flag helpers.
@@ -233,20 +261,23 @@ static void ExecuteConditionalBranch(bool condition, MCS6502Instruction *instruc
 #define CTXP_SET(f) (context->p |= (f))
 #define CTXP_CLEAR(f) (context->p &= (~(f)))
 #define CTXP_ISSET(f) ((context->p & (f)) != 0)
-static inline void SetCarry(MCS6502ExecutionContext *context) { CTXP_SET(MCS6502_STATUS_C); }
-static inline void ClearCarry(MCS6502ExecutionContext *context) { CTXP_CLEAR(MCS6502_STATUS_C); }
-static inline bool IsCarrySet(MCS6502ExecutionContext *context) { return CTXP_ISSET(MCS6502_STATUS_C); }
+
+// N, Z, C and V are kept lazily (see the lazy* fields of the context), so setting them
+// is a plain store instead of a read-modify-write of p. I and D live in p.
+static inline void SetCarry(MCS6502ExecutionContext *context) { context->lazyCarry = true; }
+static inline void ClearCarry(MCS6502ExecutionContext *context) { context->lazyCarry = false; }
+static inline bool IsCarrySet(MCS6502ExecutionContext *context) { return context->lazyCarry; }
 
 static inline void SetOrClearCarry(bool c, MCS6502ExecutionContext *context) {
-    if (c) { SetCarry(context); } else { ClearCarry(context); }
+    context->lazyCarry = c;
 }
 
-static inline void SetZero(MCS6502ExecutionContext *context) { CTXP_SET(MCS6502_STATUS_Z); }
-static inline void ClearZero(MCS6502ExecutionContext *context) { CTXP_CLEAR(MCS6502_STATUS_Z); }
-static inline bool IsZeroSet(MCS6502ExecutionContext *context) { return CTXP_ISSET(MCS6502_STATUS_Z); }
+static inline void SetZero(MCS6502ExecutionContext *context) { context->lazyZero = 0; }
+static inline void ClearZero(MCS6502ExecutionContext *context) { context->lazyZero = 1; }
+static inline bool IsZeroSet(MCS6502ExecutionContext *context) { return context->lazyZero == 0; }
 
 static inline void UpdateZero(uint8 val, MCS6502ExecutionContext *context) {
-    if (val == 0) { SetZero(context); } else { ClearZero(context); }
+    context->lazyZero = val;
 }
 
 static inline void SetInterruptDisable(MCS6502ExecutionContext *context) { CTXP_SET(MCS6502_STATUS_I); }
@@ -257,33 +288,1000 @@ static inline void SetDecimal(MCS6502ExecutionContext *context) { CTXP_SET(MCS65
 static inline void ClearDecimal(MCS6502ExecutionContext *context) { CTXP_CLEAR(MCS6502_STATUS_D); }
 static inline bool IsDecimalSet(MCS6502ExecutionContext *context) { return CTXP_ISSET(MCS6502_STATUS_D); }
 
-static inline void SetNegative(MCS6502ExecutionContext *context) { CTXP_SET(MCS6502_STATUS_N); }
-static inline void ClearNegative(MCS6502ExecutionContext *context) { CTXP_CLEAR(MCS6502_STATUS_N); }
-static inline bool IsNegativeSet(MCS6502ExecutionContext *context) { return CTXP_ISSET(MCS6502_STATUS_N); }
+static inline void SetNegative(MCS6502ExecutionContext *context) { context->lazyNegative = 0x80; }
+static inline void ClearNegative(MCS6502ExecutionContext *context) { context->lazyNegative = 0; }
+static inline bool IsNegativeSet(MCS6502ExecutionContext *context) { return (context->lazyNegative & 0x80) != 0; }
 
 static inline void UpdateNegative(uint8 val, MCS6502ExecutionContext *context) {
-    if ((val & 0x80) != 0) { SetNegative(context); } else { ClearNegative(context); }
+    context->lazyNegative = val;
 }
 
-static inline void SetOverflow(MCS6502ExecutionContext *context) { CTXP_SET(MCS6502_STATUS_V); }
-static inline void ClearOverflow(MCS6502ExecutionContext *context) { CTXP_CLEAR(MCS6502_STATUS_V); }
-static inline bool IsOverflowSet(MCS6502ExecutionContext *context) { return CTXP_ISSET(MCS6502_STATUS_V); }
+static inline void SetOverflow(MCS6502ExecutionContext *context) { context->lazyOverflow = true; }
+static inline void ClearOverflow(MCS6502ExecutionContext *context) { context->lazyOverflow = false; }
+static inline bool IsOverflowSet(MCS6502ExecutionContext *context) { return context->lazyOverflow; }
 
 static inline void SetOrClearOverflow(bool v, MCS6502ExecutionContext *context) {
-    if (v) { SetOverflow(context); } else { ClearOverflow(context); }
+    context->lazyOverflow = v;
 }
 
 static inline void UpdateZeroNegative(uint8 val, MCS6502ExecutionContext *context) {
-    UpdateZero(val, context);
-    UpdateNegative(val, context);
+    context->lazyZero = val;
+    context->lazyNegative = val;
+}
+
+// The status register with the lazy flags folded in
+static inline uint8 PackedStatus(MCS6502ExecutionContext *context) {
+    uint8 p = context->p & ~(MCS6502_STATUS_N | MCS6502_STATUS_V | MCS6502_STATUS_Z | MCS6502_STATUS_C);
+    p |= context->lazyNegative & MCS6502_STATUS_N;
+    p |= context->lazyOverflow ? MCS6502_STATUS_V : 0;
+    p |= context->lazyZero == 0 ? MCS6502_STATUS_Z : 0;
+    p |= context->lazyCarry ? MCS6502_STATUS_C : 0;
+    return p;
+}
+
+// Folds the lazy flags into p, for when control returns to the caller
+static inline void PackStatus(MCS6502ExecutionContext *context) {
+    context->p = PackedStatus(context);
+}
+
+// Sets N, V, Z and C from the matching bits of a status byte
+static inline void LoadArithmeticFlags(uint8 status, MCS6502ExecutionContext *context) {
+    context->lazyNegative = status;
+    context->lazyOverflow = (status & MCS6502_STATUS_V) != 0;
+    context->lazyZero = (status & MCS6502_STATUS_Z) ? 0 : 1;
+    context->lazyCarry = (status & MCS6502_STATUS_C) != 0;
+}
+
+// Loads the lazy flags from p, which the caller (or PLP/RTI) may have changed
+static inline void UnpackStatus(MCS6502ExecutionContext *context) {
+    LoadArithmeticFlags(context->p, context);
 }
 #undef CTXP_SET
 #undef CTXP_CLEAR
 #undef CTXP_ISSET
 
+//
+// Decimal mode
+//
+// ADC and SBC with D set follow the NMOS 6502, including what it does with digits
+// above 9, as worked out in Bruce Clark's "Decimal Mode" tutorial on 6502.org:
+// ADC's Z comes from the binary sum and its N and V from the sum before the high
+// digit is adjusted; SBC's flags are those of a binary SBC. The reference functions
+// below spell that out and the per-opcode handlers look the answers up in tables
+// built from them, one entry of (flags << 8 | result) per accumulator, operand and
+// carry. tools/decimal_check.c checks every entry (see CheckDecimalMode()).
+//
+
+static uint16 DecimalAddReference(uint8 a, uint8 operand, bool carry) {
+    int low = (a & 0x0F) + (operand & 0x0F) + (carry ? 1 : 0);
+    if (low >= 0x0A) {
+        low = ((low + 0x06) & 0x0F) + 0x10;
+    }
+    int sum = (a & 0xF0) + (operand & 0xF0) + low;
+    int signedSum = (signed char) (a & 0xF0) + (signed char) (operand & 0xF0) + low;
+    uint8 flags = 0;
+    if (signedSum & 0x80) {
+        flags |= MCS6502_STATUS_N;
+    }
+    if (signedSum < -128 || signedSum > 127) {
+        flags |= MCS6502_STATUS_V;
+    }
+    if (((a + operand + (carry ? 1 : 0)) & 0xFF) == 0) {
+        flags |= MCS6502_STATUS_Z;
+    }
+    if (sum >= 0xA0) {
+        sum += 0x60;
+    }
+    if (sum >= 0x100) {
+        flags |= MCS6502_STATUS_C;
+    }
+    return (flags << 8) | (sum & 0xFF);
+}
+
+static uint16 DecimalSubtractReference(uint8 a, uint8 operand, bool carry) {
+    int low = (a & 0x0F) - (operand & 0x0F) + (carry ? 0 : -1);
+    if (low < 0) {
+        low = ((low - 0x06) & 0x0F) - 0x10;
+    }
+    int difference = (a & 0xF0) - (operand & 0xF0) + low;
+    if (difference < 0) {
+        difference -= 0x60;
+    }
+    int binary = a - operand - (carry ? 0 : 1);
+    uint8 flags = binary & MCS6502_STATUS_N;
+    if ((a ^ operand) & (a ^ binary) & 0x80) {
+        flags |= MCS6502_STATUS_V;
+    }
+    if ((binary & 0xFF) == 0) {
+        flags |= MCS6502_STATUS_Z;
+    }
+    if (binary >= 0) {
+        flags |= MCS6502_STATUS_C;
+    }
+    return (flags << 8) | (difference & 0xFF);
+}
+
+// [carry][accumulator][operand]
+static uint16 MCS6502DecimalAddTable[2][256][256];
+static uint16 MCS6502DecimalSubtractTable[2][256][256];
+
+static void BuildDecimalTables(void) {
+    for (int carry = 0; carry < 2; carry++) {
+        for (int a = 0; a < 256; a++) {
+            for (int operand = 0; operand < 256; operand++) {
+                MCS6502DecimalAddTable[carry][a][operand] = DecimalAddReference(a, operand, carry);
+                MCS6502DecimalSubtractTable[carry][a][operand] = DecimalSubtractReference(a, operand, carry);
+            }
+        }
+    }
+}
+
+//
+// Per-opcode handlers
+//
+// Every entry in MCS6502_INSTRUCTION_LIST gets its own handler function. The addressing
+// mode, base timing and page-crossing rule are passed to the mnemonic's implementation
+// as constants, so once everything is inlined the addressing mode switches fold away and
+// each handler does only the work of its own opcode. Read-modify-write instructions also
+// decode their operand address just once.
+//
+// Define MCS6502_REFERENCE_SWITCH to build the original single switch decoder in
+// MCS6502ExecNext instead. It is kept as a readable reference and for checking the
+// handlers against it.
+//
+
+#ifndef MCS6502_REFERENCE_SWITCH
+
+// Handlers get the raw operand bytes that follow the opcode already fetched (see
+// FetchOperand), which lets the block cache below hand them predecoded operands.
+typedef void (*MCS6502OpcodeHandler)(MCS6502ExecutionContext *context, uint16 operand);
+
+typedef struct _MCS6502OpcodeEntry {
+    MCS6502OpcodeHandler handler;
+    uint8 length;
+} MCS6502OpcodeEntry;
+
+#define MCS6502_OPERATION_PARAMS \
+    MCS6502AddressingMode mode, int timing, bool timingAddOne, uint16 operand, MCS6502ExecutionContext *context
+
+static MCS6502_ALWAYS_INLINE void FinishInstruction(MCS6502AddressingMode mode, int timing,
+                                                    MCS6502ExecutionContext *context) {
+    context->pc = context->pc + LengthForMode(mode);
+    context->timingForLastOperation += timing;
+}
+
+static MCS6502_ALWAYS_INLINE uint16 OperandAddress(MCS6502AddressingMode mode, bool timingAddOne, uint16 operand,
+                                                   MCS6502ExecutionContext *context) {
+    if (!timingAddOne) {
+        return EffectiveOperandAddressForMode(mode, operand, context, NULL);
+    }
+    bool crossesPageBoundary = false;
+    uint16 addr = EffectiveOperandAddressForMode(mode, operand, context, &crossesPageBoundary);
+    if (crossesPageBoundary) {
+        context->timingForLastOperation += 1;
+    }
+    return addr;
+}
+
+static MCS6502_ALWAYS_INLINE uint8 ReadOperand(MCS6502AddressingMode mode, bool timingAddOne, uint16 operand,
+                                               MCS6502ExecutionContext *context) {
+    if (mode == MCS6502AddressingImmediate) {
+        return (uint8) operand;
+    }
+    return MCS6502ReadByte(OperandAddress(mode, timingAddOne, operand, context), context);
+}
+
+// Shared ALU and shift operations. Each takes its input value, updates the flags
+// and returns the result.
+
+static MCS6502_ALWAYS_INLINE uint8 AddWithCarry(uint8 operand, MCS6502ExecutionContext *context) {
+    if (!IsDecimalSet(context)) {
+        unsigned int sum = context->a + operand + (IsCarrySet(context) ? 1 : 0);
+        int vres = (signed char) context->a + (signed char) operand + (IsCarrySet(context) ? 1 : 0);
+        uint8 result = sum & 0xFF;
+        SetOrClearCarry((sum > 0xFF), context);
+        UpdateZeroNegative(result, context);
+        SetOrClearOverflow((vres > 127 || vres < -128), context);
+        return result;
+    }
+    uint16 entry = MCS6502DecimalAddTable[IsCarrySet(context)][context->a][operand];
+    LoadArithmeticFlags(entry >> 8, context);
+    return entry & 0xFF;
+}
+
+static MCS6502_ALWAYS_INLINE uint8 SubtractWithBorrow(uint8 operand, MCS6502ExecutionContext *context) {
+    if (!IsDecimalSet(context)) {
+        return AddWithCarry(~operand, context);
+    }
+    uint16 entry = MCS6502DecimalSubtractTable[IsCarrySet(context)][context->a][operand];
+    LoadArithmeticFlags(entry >> 8, context);
+    return entry & 0xFF;
+}
+
+static MCS6502_ALWAYS_INLINE void Compare(uint8 reg, uint8 operand, MCS6502ExecutionContext *context) {
+    SetOrClearCarry((reg >= operand), context);
+    UpdateZeroNegative((uint8) (reg - operand), context);
+}
+
+static MCS6502_ALWAYS_INLINE uint8 ShiftLeft(uint8 val, MCS6502ExecutionContext *context) {
+    SetOrClearCarry((val & 0x80) != 0, context);
+    val <<= 1;
+    UpdateZeroNegative(val, context);
+    return val;
+}
+
+static MCS6502_ALWAYS_INLINE uint8 ShiftRight(uint8 val, MCS6502ExecutionContext *context) {
+    SetOrClearCarry((val & 0x01) != 0, context);
+    val >>= 1;
+    UpdateZeroNegative(val, context);
+    return val;
+}
+
+static MCS6502_ALWAYS_INLINE uint8 RotateLeft(uint8 val, MCS6502ExecutionContext *context) {
+    bool initialCarry = IsCarrySet(context);
+    SetOrClearCarry((val & 0x80) != 0, context);
+    val = (uint8) (val << 1) | (initialCarry ? 0x01 : 0x00);
+    UpdateZeroNegative(val, context);
+    return val;
+}
+
+static MCS6502_ALWAYS_INLINE uint8 RotateRight(uint8 val, MCS6502ExecutionContext *context) {
+    bool initialCarry = IsCarrySet(context);
+    SetOrClearCarry((val & 0x01) != 0, context);
+    val = (val >> 1) | (initialCarry ? 0x80 : 0x00);
+    UpdateZeroNegative(val, context);
+    return val;
+}
+
+static MCS6502_ALWAYS_INLINE uint8 Decrement(uint8 val, MCS6502ExecutionContext *context) {
+    val--;
+    UpdateZeroNegative(val, context);
+    return val;
+}
+
+static MCS6502_ALWAYS_INLINE uint8 Increment(uint8 val, MCS6502ExecutionContext *context) {
+    val++;
+    UpdateZeroNegative(val, context);
+    return val;
+}
+
+// Read-modify-write instructions work either on the accumulator or on a memory
+// location whose address is decoded once and used for both the read and the write.
+#define MCS6502_READ_MODIFY_WRITE(operation)                                        \
+    if (mode == MCS6502AddressingAccumulator) {                                     \
+        context->a = operation(context->a, context);                                \
+    } else {                                                                        \
+        uint16 addr = OperandAddress(mode, false, operand, context);                \
+        MCS6502WriteByte(addr, operation(MCS6502ReadByte(addr, context), context), context); \
+    }                                                                               \
+    FinishInstruction(mode, timing, context)
+
+static MCS6502_ALWAYS_INLINE void BranchIf(bool condition, bool timingAddOne, uint16 operand,
+                                           MCS6502ExecutionContext *context) {
+    if (condition) {
+        bool crossesPageBoundary = false;
+        context->pc = EffectiveOperandAddressForMode(MCS6502AddressingRelative, operand, context,
+                                                     &crossesPageBoundary);
+        context->timingForLastOperation += 3;
+        if (timingAddOne && crossesPageBoundary) {
+            context->timingForLastOperation += 1;
+        }
+    } else {
+        context->pc = context->pc + 2;
+        context->timingForLastOperation += 2;
+    }
+}
+
+// Mnemonic implementations. These are only ever called from the generated handlers,
+// with constant arguments for everything but the context.
+
+static MCS6502_ALWAYS_INLINE void ExecuteADC(MCS6502_OPERATION_PARAMS) {
+    uint8 value = ReadOperand(mode, timingAddOne, operand, context);
+    context->a = AddWithCarry(value, context);
+    FinishInstruction(mode, timing, context);
+}
+
+static MCS6502_ALWAYS_INLINE void ExecuteAND(MCS6502_OPERATION_PARAMS) {
+    context->a = context->a & ReadOperand(mode, timingAddOne, operand, context);
+    UpdateZeroNegative(context->a, context);
+    FinishInstruction(mode, timing, context);
+}
+
+static MCS6502_ALWAYS_INLINE void ExecuteASL(MCS6502_OPERATION_PARAMS) {
+    MCS6502_READ_MODIFY_WRITE(ShiftLeft);
+}
+
+static MCS6502_ALWAYS_INLINE void ExecuteBCC(MCS6502_OPERATION_PARAMS) {
+    BranchIf(!IsCarrySet(context), timingAddOne, operand, context);
+}
+
+static MCS6502_ALWAYS_INLINE void ExecuteBCS(MCS6502_OPERATION_PARAMS) {
+    BranchIf(IsCarrySet(context), timingAddOne, operand, context);
+}
+
+static MCS6502_ALWAYS_INLINE void ExecuteBEQ(MCS6502_OPERATION_PARAMS) {
+    BranchIf(IsZeroSet(context), timingAddOne, operand, context);
+}
+
+static MCS6502_ALWAYS_INLINE void ExecuteBIT(MCS6502_OPERATION_PARAMS) {
+    uint8 value = ReadOperand(mode, timingAddOne, operand, context);
+    UpdateNegative(value, context);
+    UpdateZero(context->a & value, context);
+    SetOrClearOverflow((value & 0x40) != 0, context);
+    FinishInstruction(mode, timing, context);
+}
+
+static MCS6502_ALWAYS_INLINE void ExecuteBMI(MCS6502_OPERATION_PARAMS) {
+    BranchIf(IsNegativeSet(context), timingAddOne, operand, context);
+}
+
+static MCS6502_ALWAYS_INLINE void ExecuteBNE(MCS6502_OPERATION_PARAMS) {
+    BranchIf(!IsZeroSet(context), timingAddOne, operand, context);
+}
+
+static MCS6502_ALWAYS_INLINE void ExecuteBPL(MCS6502_OPERATION_PARAMS) {
+    BranchIf(!IsNegativeSet(context), timingAddOne, operand, context);
+}
+
+static MCS6502_ALWAYS_INLINE void ExecuteBRK(MCS6502_OPERATION_PARAMS) {
+    uint16 nextPC = context->pc + 2; // BRK can replace a 2-byte instruction; RTI returns to actual PC.
+    PushByte((nextPC >> 8) & 0xFF, context);
+    PushByte(nextPC & 0xFF, context);
+    PushFlags(true, context);
+    SetInterruptDisable(context);
+    context->pc = ReadWordAtAddress(MCS6502_IRQ_BRK, context);
+    context->timingForLastOperation += timing;
+}
+
+static MCS6502_ALWAYS_INLINE void ExecuteBVC(MCS6502_OPERATION_PARAMS) {
+    BranchIf(!IsOverflowSet(context), timingAddOne, operand, context);
+}
+
+static MCS6502_ALWAYS_INLINE void ExecuteBVS(MCS6502_OPERATION_PARAMS) {
+    BranchIf(IsOverflowSet(context), timingAddOne, operand, context);
+}
+
+static MCS6502_ALWAYS_INLINE void ExecuteCLC(MCS6502_OPERATION_PARAMS) {
+    ClearCarry(context);
+    FinishInstruction(mode, timing, context);
+}
+
+static MCS6502_ALWAYS_INLINE void ExecuteCLD(MCS6502_OPERATION_PARAMS) {
+    ClearDecimal(context);
+    FinishInstruction(mode, timing, context);
+}
+
+static MCS6502_ALWAYS_INLINE void ExecuteCLI(MCS6502_OPERATION_PARAMS) {
+    ClearInterruptDisable(context);
+    FinishInstruction(mode, timing, context);
+}
+
+static MCS6502_ALWAYS_INLINE void ExecuteCLV(MCS6502_OPERATION_PARAMS) {
+    ClearOverflow(context);
+    FinishInstruction(mode, timing, context);
+}
+
+static MCS6502_ALWAYS_INLINE void ExecuteCMP(MCS6502_OPERATION_PARAMS) {
+    Compare(context->a, ReadOperand(mode, timingAddOne, operand, context), context);
+    FinishInstruction(mode, timing, context);
+}
+
+static MCS6502_ALWAYS_INLINE void ExecuteCPX(MCS6502_OPERATION_PARAMS) {
+    Compare(context->x, ReadOperand(mode, timingAddOne, operand, context), context);
+    FinishInstruction(mode, timing, context);
+}
+
+static MCS6502_ALWAYS_INLINE void ExecuteCPY(MCS6502_OPERATION_PARAMS) {
+    Compare(context->y, ReadOperand(mode, timingAddOne, operand, context), context);
+    FinishInstruction(mode, timing, context);
+}
+
+static MCS6502_ALWAYS_INLINE void ExecuteDEC(MCS6502_OPERATION_PARAMS) {
+    MCS6502_READ_MODIFY_WRITE(Decrement);
+}
+
+static MCS6502_ALWAYS_INLINE void ExecuteDEX(MCS6502_OPERATION_PARAMS) {
+    context->x = Decrement(context->x, context);
+    FinishInstruction(mode, timing, context);
+}
+
+static MCS6502_ALWAYS_INLINE void ExecuteDEY(MCS6502_OPERATION_PARAMS) {
+    context->y = Decrement(context->y, context);
+    FinishInstruction(mode, timing, context);
+}
+
+static MCS6502_ALWAYS_INLINE void ExecuteEOR(MCS6502_OPERATION_PARAMS) {
+    context->a = context->a ^ ReadOperand(mode, timingAddOne, operand, context);
+    UpdateZeroNegative(context->a, context);
+    FinishInstruction(mode, timing, context);
+}
+
+static MCS6502_ALWAYS_INLINE void ExecuteINC(MCS6502_OPERATION_PARAMS) {
+    MCS6502_READ_MODIFY_WRITE(Increment);
+}
+
+static MCS6502_ALWAYS_INLINE void ExecuteINX(MCS6502_OPERATION_PARAMS) {
+    context->x = Increment(context->x, context);
+    FinishInstruction(mode, timing, context);
+}
+
+static MCS6502_ALWAYS_INLINE void ExecuteINY(MCS6502_OPERATION_PARAMS) {
+    context->y = Increment(context->y, context);
+    FinishInstruction(mode, timing, context);
+}
+
+static MCS6502_ALWAYS_INLINE void ExecuteJMP(MCS6502_OPERATION_PARAMS) {
+    context->pc = OperandAddress(mode, false, operand, context);
+    context->timingForLastOperation += timing;
+}
+
+static MCS6502_ALWAYS_INLINE void ExecuteJSR(MCS6502_OPERATION_PARAMS) {
+    uint16 destAddr = OperandAddress(mode, false, operand, context);
+    uint16 returnAddr = context->pc + 2;
+    PushByte(((returnAddr >> 8) & 0xFF), context);
+    PushByte((returnAddr & 0xFF), context);
+    context->pc = destAddr;
+    context->timingForLastOperation += timing;
+}
+
+static MCS6502_ALWAYS_INLINE void ExecuteLDA(MCS6502_OPERATION_PARAMS) {
+    context->a = ReadOperand(mode, timingAddOne, operand, context);
+    UpdateZeroNegative(context->a, context);
+    FinishInstruction(mode, timing, context);
+}
+
+static MCS6502_ALWAYS_INLINE void ExecuteLDX(MCS6502_OPERATION_PARAMS) {
+    context->x = ReadOperand(mode, timingAddOne, operand, context);
+    UpdateZeroNegative(context->x, context);
+    FinishInstruction(mode, timing, context);
+}
+
+static MCS6502_ALWAYS_INLINE void ExecuteLDY(MCS6502_OPERATION_PARAMS) {
+    context->y = ReadOperand(mode, timingAddOne, operand, context);
+    UpdateZeroNegative(context->y, context);
+    FinishInstruction(mode, timing, context);
+}
+
+static MCS6502_ALWAYS_INLINE void ExecuteLSR(MCS6502_OPERATION_PARAMS) {
+    MCS6502_READ_MODIFY_WRITE(ShiftRight);
+}
+
+static MCS6502_ALWAYS_INLINE void ExecuteNOP(MCS6502_OPERATION_PARAMS) {
+    FinishInstruction(mode, timing, context);
+}
+
+static MCS6502_ALWAYS_INLINE void ExecuteORA(MCS6502_OPERATION_PARAMS) {
+    context->a = context->a | ReadOperand(mode, timingAddOne, operand, context);
+    UpdateZeroNegative(context->a, context);
+    FinishInstruction(mode, timing, context);
+}
+
+static MCS6502_ALWAYS_INLINE void ExecutePHA(MCS6502_OPERATION_PARAMS) {
+    PushByte(context->a, context);
+    FinishInstruction(mode, timing, context);
+}
+
+static MCS6502_ALWAYS_INLINE void ExecutePHP(MCS6502_OPERATION_PARAMS) {
+    PushFlags(true, context);
+    FinishInstruction(mode, timing, context);
+}
+
+static MCS6502_ALWAYS_INLINE void ExecutePLA(MCS6502_OPERATION_PARAMS) {
+    context->a = PullByte(context);
+    UpdateZeroNegative(context->a, context);
+    FinishInstruction(mode, timing, context);
+}
+
+static MCS6502_ALWAYS_INLINE void ExecutePLP(MCS6502_OPERATION_PARAMS) {
+    context->p = PullByte(context) & ~(0x20 | MCS6502_STATUS_B);
+    UnpackStatus(context);
+    FinishInstruction(mode, timing, context);
+}
+
+static MCS6502_ALWAYS_INLINE void ExecuteROL(MCS6502_OPERATION_PARAMS) {
+    MCS6502_READ_MODIFY_WRITE(RotateLeft);
+}
+
+static MCS6502_ALWAYS_INLINE void ExecuteROR(MCS6502_OPERATION_PARAMS) {
+    MCS6502_READ_MODIFY_WRITE(RotateRight);
+}
+
+static MCS6502_ALWAYS_INLINE void ExecuteRTI(MCS6502_OPERATION_PARAMS) {
+    context->p = PullByte(context) & ~(0x20 | MCS6502_STATUS_B);
+    UnpackStatus(context);
+    uint8 lo = PullByte(context);
+    uint8 hi = PullByte(context);
+    context->pc = ((hi << 8) | lo);
+    context->timingForLastOperation += timing;
+}
+
+static MCS6502_ALWAYS_INLINE void ExecuteRTS(MCS6502_OPERATION_PARAMS) {
+    uint8 lo = PullByte(context);
+    uint8 hi = PullByte(context);
+    context->pc = ((hi << 8) | lo) + 1;
+    context->timingForLastOperation += timing;
+}
+
+static MCS6502_ALWAYS_INLINE void ExecuteSBC(MCS6502_OPERATION_PARAMS) {
+    uint8 value = ReadOperand(mode, timingAddOne, operand, context);
+    context->a = SubtractWithBorrow(value, context);
+    FinishInstruction(mode, timing, context);
+}
+
+static MCS6502_ALWAYS_INLINE void ExecuteSEC(MCS6502_OPERATION_PARAMS) {
+    SetCarry(context);
+    FinishInstruction(mode, timing, context);
+}
+
+static MCS6502_ALWAYS_INLINE void ExecuteSED(MCS6502_OPERATION_PARAMS) {
+    SetDecimal(context);
+    FinishInstruction(mode, timing, context);
+}
+
+static MCS6502_ALWAYS_INLINE void ExecuteSEI(MCS6502_OPERATION_PARAMS) {
+    SetInterruptDisable(context);
+    FinishInstruction(mode, timing, context);
+}
+
+static MCS6502_ALWAYS_INLINE void ExecuteSTA(MCS6502_OPERATION_PARAMS) {
+    MCS6502WriteByte(OperandAddress(mode, false, operand, context), context->a, context);
+    FinishInstruction(mode, timing, context);
+}
+
+static MCS6502_ALWAYS_INLINE void ExecuteSTX(MCS6502_OPERATION_PARAMS) {
+    MCS6502WriteByte(OperandAddress(mode, false, operand, context), context->x, context);
+    FinishInstruction(mode, timing, context);
+}
+
+static MCS6502_ALWAYS_INLINE void ExecuteSTY(MCS6502_OPERATION_PARAMS) {
+    MCS6502WriteByte(OperandAddress(mode, false, operand, context), context->y, context);
+    FinishInstruction(mode, timing, context);
+}
+
+static MCS6502_ALWAYS_INLINE void ExecuteTAX(MCS6502_OPERATION_PARAMS) {
+    context->x = context->a;
+    UpdateZeroNegative(context->x, context);
+    FinishInstruction(mode, timing, context);
+}
+
+static MCS6502_ALWAYS_INLINE void ExecuteTAY(MCS6502_OPERATION_PARAMS) {
+    context->y = context->a;
+    UpdateZeroNegative(context->y, context);
+    FinishInstruction(mode, timing, context);
+}
+
+static MCS6502_ALWAYS_INLINE void ExecuteTSX(MCS6502_OPERATION_PARAMS) {
+    context->x = context->sp;
+    UpdateZeroNegative(context->x, context);
+    FinishInstruction(mode, timing, context);
+}
+
+static MCS6502_ALWAYS_INLINE void ExecuteTXA(MCS6502_OPERATION_PARAMS) {
+    context->a = context->x;
+    UpdateZeroNegative(context->a, context);
+    FinishInstruction(mode, timing, context);
+}
+
+static MCS6502_ALWAYS_INLINE void ExecuteTXS(MCS6502_OPERATION_PARAMS) {
+    context->sp = context->x;
+    FinishInstruction(mode, timing, context);
+}
+
+static MCS6502_ALWAYS_INLINE void ExecuteTYA(MCS6502_OPERATION_PARAMS) {
+    context->a = context->y;
+    UpdateZeroNegative(context->a, context);
+    FinishInstruction(mode, timing, context);
+}
+
+#undef MCS6502_READ_MODIFY_WRITE
+#undef MCS6502_OPERATION_PARAMS
+
+// One handler per opcode, e.g. MCS6502Handler_0x69 for ADC #imm...
+#define MCS6502_DEFINE_HANDLER(opcode, mnemonic, mode, timing, timingAddOne)               \
+    static void MCS6502Handler_##opcode(MCS6502ExecutionContext *context, uint16 operand) { \
+        Execute##mnemonic(MCS6502Addressing##mode, timing, timingAddOne, operand, context); \
+    }
+MCS6502_INSTRUCTION_LIST(MCS6502_DEFINE_HANDLER)
+#undef MCS6502_DEFINE_HANDLER
+
+// ...and the dispatch table indexed by opcode, with each instruction's length so the
+// operand can be fetched up front. Invalid opcodes are left empty.
+#define MCS6502_LENGTH_Implied 1
+#define MCS6502_LENGTH_Accumulator 1
+#define MCS6502_LENGTH_Immediate 2
+#define MCS6502_LENGTH_ZeroPage 2
+#define MCS6502_LENGTH_ZeroPageX 2
+#define MCS6502_LENGTH_ZeroPageY 2
+#define MCS6502_LENGTH_XIndirect 2
+#define MCS6502_LENGTH_IndirectY 2
+#define MCS6502_LENGTH_Relative 2
+#define MCS6502_LENGTH_Absolute 3
+#define MCS6502_LENGTH_AbsoluteX 3
+#define MCS6502_LENGTH_AbsoluteY 3
+#define MCS6502_LENGTH_Indirect 3
+static const MCS6502OpcodeEntry MCS6502HandlerTable[256] = {
+#define MCS6502_HANDLER_ENTRY(opcode, mnemonic, mode, timing, timingAddOne) \
+    [opcode] = {MCS6502Handler_##opcode, MCS6502_LENGTH_##mode},
+    MCS6502_INSTRUCTION_LIST(MCS6502_HANDLER_ENTRY)
+#undef MCS6502_HANDLER_ENTRY
+};
+
+#ifdef MCS6502_CHECK_DECIMAL
+// Runs ADC #imm and SBC #imm in decimal mode for every accumulator, operand and carry
+// and checks the result and flags against the reference functions. For valid BCD
+// inputs it also checks the reference result and carry against plain decimal
+// arithmetic. Reports problems on stderr and returns the number found. Built only for
+// the decimal_check tool, which defines MCS6502_CHECK_DECIMAL.
+static int CheckDecimalMode(void) {
+    static MCS6502ExecutionContext scratch;
+    int failures = 0;
+    for (int carry = 0; carry < 2; carry++) {
+        for (int a = 0; a < 256; a++) {
+            for (int operand = 0; operand < 256; operand++) {
+                for (int subtract = 0; subtract < 2; subtract++) {
+                    uint16 expected = subtract ? DecimalSubtractReference(a, operand, carry)
+                                               : DecimalAddReference(a, operand, carry);
+                    scratch.a = a;
+                    scratch.p = MCS6502_STATUS_D | (carry ? MCS6502_STATUS_C : 0);
+                    UnpackStatus(&scratch);
+                    if (subtract) {
+                        MCS6502Handler_0xE9(&scratch, operand);
+                    } else {
+                        MCS6502Handler_0x69(&scratch, operand);
+                    }
+                    uint8 flags = PackedStatus(&scratch) & ~MCS6502_STATUS_D;
+                    bool ok = scratch.a == (expected & 0xFF) && flags == (expected >> 8);
+
+                    bool validBCD = (a & 0x0F) < 10 && a < 0xA0 && (operand & 0x0F) < 10 && operand < 0xA0;
+                    if (validBCD) {
+                        int decimalA = (a >> 4) * 10 + (a & 0x0F);
+                        int decimalOperand = (operand >> 4) * 10 + (operand & 0x0F);
+                        int value = subtract ? decimalA - decimalOperand - !carry
+                                             : decimalA + decimalOperand + carry;
+                        bool expectedCarry = subtract ? value >= 0 : value > 99;
+                        value = (value + 100) % 100;
+                        ok = ok && (expected & 0xFF) == ((value / 10) << 4 | value % 10) &&
+                             ((expected >> 8 & MCS6502_STATUS_C) != 0) == expectedCarry;
+                    }
+                    if (!ok) {
+                        failures++;
+                        fprintf(stderr, "MCS6502: decimal %s A=%02X M=%02X C=%d gives %02X/%02X, expected %02X/%02X\n",
+                                subtract ? "SBC" : "ADC", a, operand, carry, scratch.a, flags,
+                                expected & 0xFF, expected >> 8);
+                    }
+                }
+            }
+        }
+    }
+    return failures;
+}
+#endif
+
+//
+// Decoded block cache
+//
+// A block is a run of instructions from one page, ending at the first branch, jump,
+// call, return or BRK (or when full). It stores each instruction's handler, operand and
+// the PC it should fall through to, along with the write generation of its page when
+// it was decoded. The cache is direct-mapped on a hash of the start PC.
+//
+
+#define MCS6502_BLOCK_CACHE_SIZE 8192 // Must be a power of two
+#define MCS6502_BLOCK_MAX_INSTRUCTIONS 16
+
+typedef struct _MCS6502DecodedInstruction {
+    MCS6502OpcodeHandler handler;
+    uint16 operand;
+    uint16 nextPC;
+} MCS6502DecodedInstruction;
+
+typedef struct _MCS6502Block {
+    uint16 startPC;
+    uint8 count; // Zero for an empty slot
+    unsigned int generation;
+    uint8 countdownOpcode; // DEX, DEY or SBC if the block is a countdown loop, see RunCountdownLoop()
+    MCS6502DecodedInstruction instructions[MCS6502_BLOCK_MAX_INSTRUCTIONS];
+} MCS6502Block;
+
+struct _MCS6502BlockCache {
+    MCS6502Block blocks[MCS6502_BLOCK_CACHE_SIZE];
+
+    // Ahead-of-time translated code, see MCS6502SetTranslatedPage()
+    MCS6502TranslatedPageFunction translatedPages[256];
+    unsigned int translatedGenerations[256];
+};
+
+static inline unsigned int BlockIndexForPC(uint16 pc) {
+    // Fibonacci hashing, so that e.g. $D123 and $F123 don't share a slot.
+    return ((uint16) (pc * 40503u)) >> 3 & (MCS6502_BLOCK_CACHE_SIZE - 1);
+}
+
+static inline bool OpcodeEndsBlock(uint8 opcode) {
+    switch (opcode) {
+        case 0x00: // BRK
+        case 0x20: // JSR
+        case 0x40: // RTI
+        case 0x4C: // JMP
+        case 0x60: // RTS
+        case 0x6C: // JMP ()
+            return true;
+        default:
+            return (opcode & 0x1F) == 0x10; // Conditional branches
+    }
+}
+
+static bool IsTrapAddress(uint16 address, MCS6502ExecutionContext *context) {
+    for (int i = 0; i < context->trapCount; i++) {
+        if (context->traps[i].address == address) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool DecodeBlock(MCS6502Block *block, uint16 pc, MCS6502ExecutionContext *context) {
+    // Code is only ever decoded straight out of mapped memory; fetching it from
+    // an I/O page through the bus could have side effects.
+    const uint8 *page = context->readPages[pc >> 8];
+    if (!page) {
+        return false;
+    }
+
+    unsigned int offset = pc & 0xFF;
+    int count = 0;
+    while (count < MCS6502_BLOCK_MAX_INSTRUCTIONS) {
+        if (count > 0 && context->trapPages[pc >> 8] && IsTrapAddress((pc & 0xFF00) + offset, context)) {
+            break; // A trap has to start its own block
+        }
+        uint8 opcode = page[offset];
+        const MCS6502OpcodeEntry *entry = &MCS6502HandlerTable[opcode];
+        if (!entry->handler || offset + entry->length > 0x100) {
+            break;
+        }
+        MCS6502DecodedInstruction *decoded = &block->instructions[count++];
+        decoded->handler = entry->handler;
+        if (entry->length == 3) {
+            decoded->operand = page[offset + 1] | (page[offset + 2] << 8);
+        } else if (entry->length == 2) {
+            decoded->operand = page[offset + 1];
+        } else {
+            decoded->operand = 0;
+        }
+        offset += entry->length;
+        decoded->nextPC = (pc & 0xFF00) + offset;
+        if (OpcodeEndsBlock(opcode)) {
+            break;
+        }
+    }
+    if (count == 0) {
+        return false;
+    }
+
+    block->startPC = pc;
+    block->count = count;
+    block->generation = context->pageWriteGenerations[pc >> 8];
+    block->countdownOpcode = 0;
+    const unsigned int start = pc & 0xFF;
+    if (count == 2 && (offset == start + 3 || offset == start + 4)) {
+        // DEX / BNE *-1, DEY / BNE *-1 or SBC #1 / BNE *-2, a delay loop
+        const uint8 *code = &page[start];
+        if (((code[0] == 0xCA || code[0] == 0x88) && code[1] == 0xD0 && code[2] == 0xFD) ||
+            (code[0] == 0xE9 && code[1] == 0x01 && code[2] == 0xD0 && code[3] == 0xFC)) {
+            block->countdownOpcode = code[0];
+        }
+    }
+    return true;
+}
+
+// Runs a countdown loop block as many times round as the budget allows (or until the
+// counter reaches zero) in one go, with the same cycles, registers and flags. Returns
+// false if it has to be left to the interpreter.
+static bool RunCountdownLoop(const MCS6502Block *block, MCS6502ExecutionContext *context, int cycleBudget) {
+    uint8 *counter;
+    if (block->countdownOpcode == 0xCA) {
+        counter = &context->x;
+    } else if (block->countdownOpcode == 0x88) {
+        counter = &context->y;
+    } else {
+        // SBC #1 only counts down by one with the carry set, in binary mode, from above zero
+        if (!context->lazyCarry || (context->p & MCS6502_STATUS_D) || context->a == 0) {
+            return false;
+        }
+        counter = &context->a;
+    }
+
+    // Decrement (2 cycles) and taken branch (3, plus 1 if the target is off the branch's
+    // page). InterpretBlock() stops after either instruction once the budget is used up,
+    // so a trip is only run whole if more than the decrement's 2 cycles are left when it
+    // starts; otherwise just the decrement is, leaving the PC on the branch.
+    uint16 branchPC = block->instructions[0].nextPC;
+    uint16 exitPC = block->instructions[1].nextPC;
+    int tripCycles = 5 + ((block->startPC >> 8) != (branchPC >> 8));
+    int trips = cycleBudget > 2 ? (cycleBudget - 3) / tripCycles + 1 : 0;
+    int count = *counter ? *counter : 256;
+    context->pendingTiming = 0;
+    if (trips >= count) {
+        // Down to zero, and the last branch isn't taken (2 cycles)
+        trips = count;
+        context->timingForLastOperation = (trips - 1) * tripCycles + 4;
+        context->pc = exitPC;
+    } else if (trips * tripCycles < cycleBudget) {
+        trips++; // Only its decrement
+        context->timingForLastOperation = (trips - 1) * tripCycles + 2;
+        context->pc = branchPC;
+    } else {
+        context->timingForLastOperation = trips * tripCycles;
+        context->pc = block->startPC;
+    }
+    *counter -= trips;
+    context->lazyNegative = *counter;
+    context->lazyZero = *counter;
+    if (counter == &context->a) {
+        context->lazyOverflow = *counter == 0x7F; // Only from $80 - 1
+    }
+    return true;
+}
+
+// Runs a decoded block and leaves its cycle count in timingForLastOperation. It leaves
+// the block early, after the current instruction, on anything the instruction-at-a-time
+// loop would notice: a PC that doesn't fall through, a stop request, a used up budget or
+// a write to the block's own page.
+static MCS6502_ALWAYS_INLINE void InterpretBlock(const MCS6502Block *block, MCS6502ExecutionContext *context, int cycleBudget) {
+    uint8 page = block->startPC >> 8;
+    context->pendingTiming = 0;
+    context->timingForLastOperation = 0;
+    const MCS6502DecodedInstruction *instruction = block->instructions;
+    const MCS6502DecodedInstruction *end = instruction + block->count;
+    do {
+        instruction->handler(context, instruction->operand);
+        if (context->pc != instruction->nextPC || context->stopRequested ||
+            (int) context->timingForLastOperation >= cycleBudget ||
+            context->pageWriteGenerations[page] != block->generation) {
+            break;
+        }
+    } while (++instruction < end);
+}
+
+// Runs translated code for the PC if there is any, otherwise the block at the PC,
+// decoding it first if needed. Returns false if there is nothing to run at the PC.
+static bool RunCachedBlock(MCS6502ExecutionContext *context, int cycleBudget) {
+    uint16 pc = context->pc;
+    struct _MCS6502BlockCache *cache = context->blockCache;
+    MCS6502Block *block = &cache->blocks[BlockIndexForPC(pc)];
+    unsigned int generation = context->pageWriteGenerations[pc >> 8];
+
+    MCS6502TranslatedPageFunction translated = cache->translatedPages[pc >> 8];
+    if (translated && !context->trapPages[pc >> 8]) { // Translated code doesn't stop at traps
+        if (cache->translatedGenerations[pc >> 8] != generation) {
+            // The page was written or remapped since it was translated.
+            cache->translatedPages[pc >> 8] = NULL;
+        } else if (translated(context, cycleBudget, generation)) {
+            return true;
+        }
+    }
+
+    if (block->count == 0 || block->startPC != pc || block->generation != generation) {
+        if (!DecodeBlock(block, pc, context)) {
+            return false;
+        }
+    }
+
+    if (block->countdownOpcode && RunCountdownLoop(block, context, cycleBudget)) {
+        return true;
+    }
+
+    InterpretBlock(block, context, cycleBudget);
+    return true;
+}
+
+#endif // MCS6502_REFERENCE_SWITCH
+
 // Debug helper:
 char *DisassembleCurrentInstruction(MCS6502Instruction *instruction, MCS6502ExecutionContext *context);
 
+#ifdef MCS6502_COUNTERS
+#define COUNTING(context) ((context)->counters != NULL || (context)->callGraph != NULL)
+
+// Adds the instruction just run from pc to the counters. The only cycles an instruction
+// takes beyond its base timing (3 for a taken branch) are for crossing a page.
+static void CountInstruction(MCS6502ExecutionContext *context, uint8 opcode, uint16 pc) {
+    MCS6502Counters *counters = context->counters;
+    const MCS6502Instruction *instruction = MCS6502OpcodeTable[opcode];
+    const unsigned int cycles = context->timingForLastOperation;
+    counters->opcodeExecutions[opcode]++;
+    counters->opcodeCycles[opcode] += cycles;
+    if (instruction->timingAddOne && cycles > (unsigned int) (instruction->timing ? instruction->timing : 3)) {
+        counters->opcodePageCrossings[opcode]++;
+    }
+    counters->pcExecutions[pc]++;
+    counters->pcCycles[pc] += cycles;
+}
+
+// The node of the innermost frame
+static inline int CallGraphTop(const MCS6502CallGraph *graph) {
+    return graph->depth > 0 ? graph->stackNodes[graph->depth - 1] : 0;
+}
+
+// Pops the frames whose return address is no longer on the stack, with S at sp
+static void CallGraphPrune(MCS6502CallGraph *graph, uint8 sp) {
+    while (graph->depth > 0 && graph->stackPointers[graph->depth - 1] <= sp + 1) {
+        graph->depth--;
+    }
+}
+
+// Pops the innermost frame that returns to pc and those inside it, if there is one
+static bool CallGraphReturn(MCS6502CallGraph *graph, uint16 pc) {
+    for (int frame = graph->depth - 1; frame >= 0; frame--) {
+        if (graph->returnAddresses[frame] == pc) {
+            graph->depth = frame;
+            return true;
+        }
+    }
+    return false;
+}
+
+// Pushes a frame for a call to routine made with S at sp, to return to returnTo
+static void CallGraphPush(MCS6502CallGraph *graph, uint16 routine, uint8 sp, uint16 returnTo) {
+    CallGraphPrune(graph, sp);
+    const int parent = CallGraphTop(graph);
+    const unsigned int mask = 2 * MCS6502_CALL_NODES - 1;
+    unsigned int slot = ((unsigned int) parent * 0x9E3779B1u + routine) & mask;
+    while (graph->children[slot] != 0 && (graph->nodes[graph->children[slot] - 1].parent != parent ||
+                                           graph->nodes[graph->children[slot] - 1].routine != routine)) {
+        slot = (slot + 1) & mask;
+    }
+    if (graph->children[slot] == 0) {
+        if (graph->nodeCount == MCS6502_CALL_NODES || graph->depth == MCS6502_CALL_DEPTH) {
+            graph->lostCalls++;
+            return;
+        }
+        MCS6502CallNode *node = &graph->nodes[graph->nodeCount];
+        node->routine = routine;
+        node->parent = parent;
+        graph->children[slot] = ++graph->nodeCount;
+    }
+    if (graph->depth == MCS6502_CALL_DEPTH) {
+        graph->lostCalls++;
+        return;
+    }
+    graph->nodes[graph->children[slot] - 1].calls++;
+    graph->stackNodes[graph->depth] = graph->children[slot] - 1;
+    graph->stackPointers[graph->depth] = sp;
+    graph->returnAddresses[graph->depth] = returnTo;
+    graph->depth++;
+}
+
+// Follows the instruction just run from pc with S at sp before it: its cycles go to the
+// current frame, then calls push a frame and returns and TXS drop the ones they left
+// behind. A return to where a frame's call would go back pops it even when its return
+// address has been moved on the stack, as Applesoft's STKINI does.
+static void CallGraphInstruction(MCS6502ExecutionContext *context, uint8 opcode, uint16 pc, uint8 sp) {
+    MCS6502CallGraph *graph = context->callGraph;
+    graph->nodes[CallGraphTop(graph)].cycles += context->timingForLastOperation;
+    switch (opcode) {
+        case 0x20: // JSR
+            CallGraphPush(graph, context->pc, sp, pc + 3);
+            break;
+        case 0x00: // BRK
+            CallGraphPush(graph, context->pc, sp, pc + 2);
+            break;
+        case 0x60: // RTS
+        case 0x40: // RTI
+            if (!CallGraphReturn(graph, context->pc)) {
+                CallGraphPrune(graph, context->sp);
+            }
+            break;
+        case 0x9A: // TXS
+            CallGraphPrune(graph, context->sp);
+            break;
+        default:
+            break;
+    }
+}
+#else
+#define COUNTING(context) false
+#endif
+
 //
 // Public functions
 //
@@ -312,10 +1310,185 @@ void MCS6502Init(
             MCS6502Instruction *instruction = &MCS6502Instructions[i];
             MCS6502OpcodeTable[instruction->opcode] = instruction;
         }
+        BuildDecimalTables();
         opcodesReady = true;
     }
 }
 
+void MCS6502MapReadPages(
+    MCS6502ExecutionContext *context,
+    uint8 firstPage,
+    unsigned int pageCount,
+    const uint8 *memory
+) {
+    for (unsigned int i = 0; i < pageCount && firstPage + i < 256; i++) {
+        context->readPages[firstPage + i] = memory ? memory + (i << 8) : NULL;
+    }
+    // Whatever was decoded from the old mapping no longer applies.
+    MCS6502InvalidatePages(context, firstPage, pageCount);
+}
+
+void MCS6502MapWritePages(
+    MCS6502ExecutionContext *context,
+    uint8 firstPage,
+    unsigned int pageCount,
+    uint8 *memory
+) {
+    for (unsigned int i = 0; i < pageCount && firstPage + i < 256; i++) {
+        context->writePages[firstPage + i] = memory ? memory + (i << 8) : NULL;
+    }
+}
+
+void MCS6502WriteProtectPages(
+    MCS6502ExecutionContext *context,
+    uint8 firstPage,
+    unsigned int pageCount
+) {
+    // Every protected page shares the same scratch page; nobody reads it back.
+    for (unsigned int i = 0; i < pageCount && firstPage + i < 256; i++) {
+        context->writePages[firstPage + i] = context->writeProtectPage;
+    }
+}
+
+void MCS6502InvalidatePages(
+    MCS6502ExecutionContext *context,
+    uint8 firstPage,
+    unsigned int pageCount
+) {
+    for (unsigned int i = 0; i < pageCount && firstPage + i < 256; i++) {
+        context->pageWriteGenerations[firstPage + i]++;
+    }
+}
+
+bool MCS6502EnableBlockCache(
+    MCS6502ExecutionContext *context
+) {
+#if defined(MCS6502_REFERENCE_SWITCH) || defined(PRINT_DEBUG_OUTPUT)
+    // The cache runs the per-opcode handlers and skips the debug output.
+    return false;
+#else
+    if (!context->blockCache) {
+        context->blockCache = calloc(1, sizeof(struct _MCS6502BlockCache));
+    }
+    return context->blockCache != NULL;
+#endif
+}
+
+void MCS6502DisableBlockCache(
+    MCS6502ExecutionContext *context
+) {
+    free(context->blockCache);
+    context->blockCache = NULL;
+}
+
+bool MCS6502EnableCounters(
+    MCS6502ExecutionContext *context
+) {
+#ifdef MCS6502_COUNTERS
+    if (!context->counters) {
+        context->counters = calloc(1, sizeof(MCS6502Counters));
+    }
+    return context->counters != NULL;
+#else
+    return false;
+#endif
+}
+
+void MCS6502DisableCounters(
+    MCS6502ExecutionContext *context
+) {
+    free(context->counters);
+    context->counters = NULL;
+}
+
+bool MCS6502EnableCallGraph(
+    MCS6502ExecutionContext *context
+) {
+#ifdef MCS6502_COUNTERS
+    if (!context->callGraph) {
+        context->callGraph = calloc(1, sizeof(MCS6502CallGraph));
+        if (context->callGraph) {
+            context->callGraph->nodeCount = 1;
+            context->callGraph->nodes[0].parent = -1;
+        }
+    }
+    return context->callGraph != NULL;
+#else
+    return false;
+#endif
+}
+
+void MCS6502DisableCallGraph(
+    MCS6502ExecutionContext *context
+) {
+    free(context->callGraph);
+    context->callGraph = NULL;
+}
+
+const char *MCS6502OpcodeMnemonic(
+    uint8 opcode
+) {
+    return MCS6502OpcodeTable[opcode] ? MCS6502OpcodeTable[opcode]->mnemonic : "???";
+}
+
+int MCS6502OpcodeLength(
+    uint8 opcode
+) {
+    return MCS6502OpcodeTable[opcode] ? LengthForInstruction(MCS6502OpcodeTable[opcode]) : 1;
+}
+
+bool MCS6502SetTrap(
+    MCS6502ExecutionContext *context,
+    uint16 address,
+    MCS6502TrapFunction function,
+    void *data
+) {
+    int i = 0;
+    while (i < context->trapCount && context->traps[i].address != address) {
+        i++;
+    }
+    if (i == context->trapCount) {
+        if (!function) {
+            return true;
+        }
+        if (context->trapCount == MCS6502_MAX_TRAPS) {
+            return false;
+        }
+        context->trapCount++;
+        context->trapPages[address >> 8]++;
+    } else if (!function) {
+        context->traps[i] = context->traps[--context->trapCount];
+        context->trapPages[address >> 8]--;
+    }
+    if (function) {
+        context->traps[i].address = address;
+        context->traps[i].function = function;
+        context->traps[i].data = data;
+    }
+
+    // Cached blocks may run straight through the address.
+    MCS6502InvalidatePages(context, address >> 8, 1);
+    return true;
+}
+
+bool MCS6502SetTranslatedPage(
+    MCS6502ExecutionContext *context,
+    uint8 page,
+    MCS6502TranslatedPageFunction function
+) {
+#ifdef MCS6502_REFERENCE_SWITCH
+    return false;
+#else
+    struct _MCS6502BlockCache *cache = context->blockCache;
+    if (!cache) {
+        return false;
+    }
+    cache->translatedPages[page] = function;
+    cache->translatedGenerations[page] = context->pageWriteGenerations[page];
+    return true;
+#endif
+}
+
 void MCS6502Reset(
     MCS6502ExecutionContext *context
 ) {
@@ -344,6 +1517,7 @@ void MCS6502IRQ(
         return;
     }
 
+    UnpackStatus(context); // p may have been changed since the last instruction
     HandleIRQ(context);
     context->pendingTiming = context->timingForLastOperation;
 }
@@ -356,6 +1530,7 @@ void MCS6502NMI(
         return;
     }
 
+    UnpackStatus(context);
     HandleNMI(context);
     context->pendingTiming = context->timingForLastOperation;
 }
@@ -378,7 +1553,93 @@ MCS6502ExecResult MCS6502Tick(MCS6502ExecutionContext *context) {
     return result;
 }
 
+// Runs the trap at the PC, if there is one and it takes over. Returns true if it did.
+static bool RunTrap(MCS6502ExecutionContext *context, int cycleBudget) {
+    for (int i = 0; i < context->trapCount; i++) {
+        if (context->traps[i].address != context->pc) {
+            continue;
+        }
+        context->pendingTiming = 0;
+        context->timingForLastOperation = 0;
+        PackStatus(context);
+        if (!context->traps[i].function(context, cycleBudget, context->traps[i].data)) {
+            return false;
+        }
+        UnpackStatus(context);
+#ifdef MCS6502_COUNTERS
+        if (context->callGraph) { // The trap may have returned from the frame its cycles go to
+            MCS6502CallGraph *graph = context->callGraph;
+            graph->nodes[CallGraphTop(graph)].cycles += context->timingForLastOperation;
+            CallGraphPrune(graph, context->sp);
+        }
+#endif
+        return true;
+    }
+    return false;
+}
+
+int MCS6502Run(MCS6502ExecutionContext *context, int cycleBudget) {
+    int remaining = cycleBudget;
+
+    // Cycles still owed by an instruction started with MCS6502Tick() count
+    // against this run.
+    remaining -= (int) context->pendingTiming;
+    context->pendingTiming = 0;
+
+    context->stopRequested = false;
+    UnpackStatus(context);
+    while (remaining > 0) {
+        // Pending interrupts are taken by ExecNextInstruction, and so is anything
+        // that can't be run as a cached block. Blocks never run through a trap.
+        if (context->trapPages[context->pc >> 8] && !context->interruptsPending &&
+            RunTrap(context, remaining)) {
+            remaining -= (int) context->timingForLastOperation;
+            if (context->stopRequested) {
+                break;
+            }
+            continue;
+        }
+#if !defined(MCS6502_REFERENCE_SWITCH) && !defined(PRINT_DEBUG_OUTPUT)
+        if (context->blockCache && !context->interruptsPending && !COUNTING(context) &&
+            RunCachedBlock(context, remaining)) {
+            remaining -= (int) context->timingForLastOperation;
+            if (context->stopRequested) {
+                break;
+            }
+            continue;
+        }
+#endif
+        if (ExecNextInstruction(context) == MCS6502ExecResultInvalidOperation) {
+            break;
+        }
+        remaining -= (int) context->timingForLastOperation;
+        if (context->stopRequested) {
+            break;
+        }
+    }
+    PackStatus(context);
+    context->stopRequested = false;
+
+    return remaining;
+}
+
+void MCS6502StopRun(MCS6502ExecutionContext *context) {
+    context->stopRequested = true;
+}
+
 MCS6502ExecResult MCS6502ExecNext(MCS6502ExecutionContext *context) {
+    UnpackStatus(context);
+    if (context->trapPages[context->pc >> 8] && !context->interruptsPending &&
+        RunTrap(context, INT_MAX)) {
+        PackStatus(context);
+        return MCS6502ExecResultRunning;
+    }
+    MCS6502ExecResult result = ExecNextInstruction(context);
+    PackStatus(context);
+    return result;
+}
+
+static MCS6502ExecResult ExecNextInstruction(MCS6502ExecutionContext *context) {
     // We expect to be called either by the tick function when there is nothing
     // pending, or by an external caller directly who intends to immediately
     // perform the next instruction. Zero out the tick counts in case
@@ -391,37 +1652,61 @@ MCS6502ExecResult MCS6502ExecNext(MCS6502ExecutionContext *context) {
 
     // If an interrupt is scheduled, do that instead of proceeding with
     // standard fetch. NMI takes precedence.
-    if (context->nmiPending) {
-        HandleNMI(context);
-        return MCS6502ExecResultRunning;
-    }
-
-    if (context->irqPending) {
-        HandleIRQ(context);
+    if (context->interruptsPending) {
+#ifdef MCS6502_COUNTERS
+        const uint8 interruptedSP = context->sp;
+        const uint16 interruptedPC = context->pc;
+#endif
+        if (context->nmiPending) {
+            HandleNMI(context);
+        } else {
+            HandleIRQ(context);
+        }
+#ifdef MCS6502_COUNTERS
+        if (context->callGraph) { // The handler is called, and its first cycles are its own
+            CallGraphPush(context->callGraph, context->pc, interruptedSP, interruptedPC);
+            context->callGraph->nodes[CallGraphTop(context->callGraph)].cycles += context->timingForLastOperation;
+        }
+#endif
         return MCS6502ExecResultRunning;
     }
 
     // Fetch opcode
     uint8 opcode = MCS6502ReadByte(context->pc, context);
+#ifndef MCS6502_REFERENCE_SWITCH
+    const MCS6502OpcodeEntry *entry = &MCS6502HandlerTable[opcode];
+    if (!entry->handler) {
+        return MCS6502ExecResultInvalidOperation;
+    }
+#endif
+#if defined(MCS6502_REFERENCE_SWITCH) || defined(PRINT_DEBUG_OUTPUT)
     MCS6502Instruction *instruction = MCS6502OpcodeTable[opcode];
     if (!instruction) {
         return MCS6502ExecResultInvalidOperation;
     }
+#endif
 
 #ifdef PRINT_DEBUG_OUTPUT
     char* dis = DisassembleCurrentInstruction(instruction, context);
     printf("%04X: %s\n", context->pc, dis);
 #endif
 
-    // All instructions will update the PC based on the length of the instruction,
-    // except instructions that modify the PC directly. Flag those situations so
-    // we can suppress the default behavior later.
-    bool doNotUpdatePC = false;
-
     // Track the original PC value so that we can known whether we are infinite-looping
     // on the same address (ie, a halt). An interrupt of some kind will kick the CPU
     // out of that state, but it's useful to be able to flag it.
     uint16 originalPC = context->pc;
+#ifdef MCS6502_COUNTERS
+    uint8 originalSP = context->sp;
+#endif
+
+#ifndef MCS6502_REFERENCE_SWITCH
+    // Decode and execute op. The handler updates the PC and adds its own timing.
+    entry->handler(context, FetchOperand(entry->length, context));
+#else
+    // All instructions will update the PC based on the length of the instruction,
+    // except instructions that modify the PC directly. Flag those situations so
+    // we can suppress the default behavior later.
+    bool doNotUpdatePC = false;
 
     // Decode and execute op
     switch (opcode) {
@@ -446,18 +1731,9 @@ MCS6502ExecResult MCS6502ExecNext(MCS6502ExecutionContext *context) {
                 UpdateZeroNegative(context->a, context);
                 SetOrClearOverflow((vres > 127 || vres < -128), context);
             } else {
-                int operandInteger = IntegerFromBCD(operand);
-                int accInteger = IntegerFromBCD(context->a);
-                int sum = operandInteger + accInteger + (IsCarrySet(context) ? 1 : 0);
-                if (sum > 99) {
-                    SetCarry(context);
-                    sum -= 100;
-                } else {
-                    ClearCarry(context);
-                }
-                context->a = BCDFromInteger(sum);
-                UpdateZeroNegative(context->a, context);
-                // Don't do anything to overflow flag. It's not documented behavior.
+                uint16 sum = DecimalAddReference(context->a, operand, IsCarrySet(context));
+                context->a = sum & 0xFF;
+                LoadArithmeticFlags(sum >> 8, context);
             }
             break;
         }
@@ -820,6 +2096,7 @@ MCS6502ExecResult MCS6502ExecNext(MCS6502ExecutionContext *context) {
             uint8 p = PullByte(context);
             p &= ~(0x20 | MCS6502_STATUS_B);
             context->p = p;
+            UnpackStatus(context);
             break;
         }
 
@@ -862,6 +2139,7 @@ MCS6502ExecResult MCS6502ExecNext(MCS6502ExecutionContext *context) {
             uint8 p = PullByte(context);
             p &= ~(0x20 | MCS6502_STATUS_B);
             context->p = p;
+            UnpackStatus(context);
             uint8 lo = PullByte(context);
             uint8 hi = PullByte(context);
             context->pc = ((hi << 8) | lo);
@@ -901,18 +2179,9 @@ MCS6502ExecResult MCS6502ExecNext(MCS6502ExecutionContext *context) {
                 UpdateZeroNegative(context->a, context);
                 SetOrClearOverflow((vres > 127 || vres < -128), context);
             } else {
-                int operandInteger = IntegerFromBCD(operand);
-                int accInteger = IntegerFromBCD(context->a);
-                int difference = accInteger - operandInteger - (IsCarrySet(context) ? 0 : 1);
-                if (difference < 0) {
-                    ClearCarry(context);
-                    difference += 100;
-                } else {
-                    SetCarry(context);
-                }
-                context->a = BCDFromInteger(difference);
-                UpdateZeroNegative(context->a, context);
-                // Don't do anything to overflow flag. It's not documented behavior.
+                uint16 difference = DecimalSubtractReference(context->a, operand, IsCarrySet(context));
+                context->a = difference & 0xFF;
+                LoadArithmeticFlags(difference >> 8, context);
             }
             break;
         }
@@ -1013,6 +2282,14 @@ MCS6502ExecResult MCS6502ExecNext(MCS6502ExecutionContext *context) {
         context->pc = context->pc + LengthForInstruction(instruction);
     }
 
+    // The base timing comes from the instruction data, but it's the final thing
+    // we add in here. In the case of branches, the data specifies zero and we
+    // have already updated the timing explicitly depending on whether the branch was taken.
+    // In several other cases, we will have conditionally added one to the cycle count
+    // in certain address modes depending on runtime indirection conditions.
+    context->timingForLastOperation += instruction->timing;
+#endif // MCS6502_REFERENCE_SWITCH
+
 #ifdef PRINT_DEBUG_OUTPUT
     // Dump the context state
     printf("  PC=%04X SP=01%02X A=%02X X=%02X Y=%02X N=%d V=%d D=%d I=%d Z=%d C=%d\n",
@@ -1034,12 +2311,14 @@ MCS6502ExecResult MCS6502ExecNext(MCS6502ExecutionContext *context) {
     }
 #endif
 
-    // The base timing comes from the instruction data, but it's the final thing
-    // we add in here. In the case of branches, the data specifies zero and we
-    // have already updated the timing explicitly depending on whether the branch was taken.
-    // In several other cases, we will have conditionally added one to the cycle count
-    // in certain address modes depending on runtime indirection conditions.
-    context->timingForLastOperation += instruction->timing;
+#ifdef MCS6502_COUNTERS
+    if (context->counters) {
+        CountInstruction(context, opcode, originalPC);
+    }
+    if (context->callGraph) {
+        CallGraphInstruction(context, opcode, originalPC, originalSP);
+    }
+#endif
 
     if (originalPC == context->pc) {
         return MCS6502ExecResultHalting;
@@ -1050,13 +2329,24 @@ MCS6502ExecResult MCS6502ExecNext(MCS6502ExecutionContext *context) {
 
 //
 // This is the "data bus": operations to read and write bytes on the bus.
+// Mapped pages are accessed directly; everything else goes to the bus functions.
 //
 
 static inline uint8 MCS6502ReadByte(uint16 addr, MCS6502ExecutionContext *context) {
+    const uint8 *page = context->readPages[addr >> 8];
+    if (page) {
+        return page[addr & 0xFF];
+    }
     return context->readByte(addr, context->readWriteContext);
 }
 
 static inline void MCS6502WriteByte(uint16 addr, uint8 byte, MCS6502ExecutionContext *context) {
+    context->pageWriteGenerations[addr >> 8]++;
+    uint8 *page = context->writePages[addr >> 8];
+    if (page) {
+        page[addr & 0xFF] = byte;
+        return;
+    }
     context->writeByte(addr, byte, context->readWriteContext);
 }
 
@@ -1071,7 +2361,7 @@ static inline void PushByte(uint8 byte, MCS6502ExecutionContext *context) {
 }
 
 static inline void PushFlags(bool b, MCS6502ExecutionContext *context) {
-    uint8 p = context->p;
+    uint8 p = PackedStatus(context);
     p |= 0x20; // bit 5 always set in pushed status
     if (b) {
         p |= MCS6502_STATUS_B;
@@ -1093,23 +2383,6 @@ static inline uint16 ReadWordAtAddress(uint16 addr, MCS6502ExecutionContext *con
     return (vechi << 8) | veclo;
 }
 
-static inline uint8 BCDFromInteger(int integer) {
-    if (integer >= 0 && integer < 100) {
-        int tens = integer / 10;
-        int units = integer % 10;
-        return ((uint8) tens << 4 | (uint8) units);
-    }
-    return 0x00;
-}
-
-// NB This routine does not validate that the input is valid BCD.
-//  You'll get garbage output if you give it invalid input.
-static inline int IntegerFromBCD(uint8 bcd) {
-    int val = ((bcd & 0xF0) >> 4) * 10;
-    val += (bcd & 0x0F);
-    return val;
-}
-
 static void HandleIRQ(MCS6502ExecutionContext *context) {
     context->irqPending = false;
     uint16 returnPC = context->pc;
@@ -1132,24 +2405,43 @@ static void HandleNMI(MCS6502ExecutionContext *context) {
     context->timingForLastOperation = 7;
 }
 
+// The operand is the raw one- or two-byte value following the opcode.
+static MCS6502_ALWAYS_INLINE uint16 FetchOperand(int length, MCS6502ExecutionContext *context) {
+    if (length == 3) {
+        return ReadWordAtAddress(context->pc + 1, context);
+    } else if (length == 2) {
+        return MCS6502ReadByte(context->pc + 1, context);
+    }
+    return 0;
+}
+
+#ifdef MCS6502_REFERENCE_SWITCH
 static uint16 EffectiveOperandAddressForInstruction(MCS6502Instruction *instruction, MCS6502ExecutionContext *context,
                                                     bool *crossesPageBoundary) {
+    uint16 operand = FetchOperand(LengthForInstruction(instruction), context);
+    return EffectiveOperandAddressForMode(instruction->mode, operand, context, crossesPageBoundary);
+}
+#endif
+
+static MCS6502_ALWAYS_INLINE uint16 EffectiveOperandAddressForMode(MCS6502AddressingMode mode, uint16 operand,
+                                                                    MCS6502ExecutionContext *context,
+                                                                    bool *crossesPageBoundary) {
 #define ADDRESSES_ON_DIFFERENT_PAGES(addr1, addr2) (((addr1) & 0xFF00) != ((addr2) & 0xFF00))
-    switch (instruction->mode) {
+    switch (mode) {
         case MCS6502AddressingZeroPage: {
-            return MCS6502ReadByte(context->pc + 1, context);
+            return (uint8) operand;
         }
         case MCS6502AddressingZeroPageX: {
-            return (uint16) (uint8) (MCS6502ReadByte(context->pc + 1, context) + context->x);
+            return (uint16) (uint8) (operand + context->x);
         }
         case MCS6502AddressingZeroPageY: {
-            return (uint16) (uint8) (MCS6502ReadByte(context->pc + 1, context) + context->y);
+            return (uint16) (uint8) (operand + context->y);
         }
         case MCS6502AddressingAbsolute: {
-            return ReadWordAtAddress(context->pc + 1, context);
+            return operand;
         }
         case MCS6502AddressingAbsoluteX: {
-            uint16 baseAddr = ReadWordAtAddress(context->pc + 1, context);
+            uint16 baseAddr = operand;
             uint16 finalAddr = baseAddr + context->x;
             if (crossesPageBoundary != NULL) {
                 *crossesPageBoundary = ADDRESSES_ON_DIFFERENT_PAGES(baseAddr, finalAddr);
@@ -1157,7 +2449,7 @@ static uint16 EffectiveOperandAddressForInstruction(MCS6502Instruction *instruct
             return finalAddr;
         }
         case MCS6502AddressingAbsoluteY: {
-            uint16 baseAddr = ReadWordAtAddress(context->pc + 1, context);
+            uint16 baseAddr = operand;
             uint16 finalAddr = baseAddr + context->y;
             if (crossesPageBoundary != NULL) {
                 *crossesPageBoundary = ADDRESSES_ON_DIFFERENT_PAGES(baseAddr, finalAddr);
@@ -1165,9 +2457,9 @@ static uint16 EffectiveOperandAddressForInstruction(MCS6502Instruction *instruct
             return finalAddr;
         }
         case MCS6502AddressingIndirect: {
-            uint8 loIndirect = MCS6502ReadByte(context->pc + 1, context);
-            uint8 hiIndirect = MCS6502ReadByte(context->pc + 2, context);
-            uint16 indirect = (hiIndirect << 8 | loIndirect);
+            uint8 loIndirect = operand & 0xFF;
+            uint8 hiIndirect = operand >> 8;
+            uint16 indirect = operand;
             // This mode has no carry so force a wrap in the hi address if it crosses
             // a page. User code should never do this because it's bad to, but we
             // will behave like the hardware would just in case.
@@ -1181,19 +2473,20 @@ static uint16 EffectiveOperandAddressForInstruction(MCS6502Instruction *instruct
             return (hi << 8 | lo);
         }
         case MCS6502AddressingXIndirect: {
-            uint8 addr = (uint8) (context->x + MCS6502ReadByte(context->pc + 1, context));
+            uint8 addr = (uint8) (context->x + operand);
             return ReadWordAtAddress(addr, context);
         }
         case MCS6502AddressingIndirectY: {
-            uint8 baseAddr = MCS6502ReadByte(context->pc + 1, context);
-            uint16 finalAddr = ReadWordAtAddress(baseAddr, context) + context->y;
+            // The carry out of adding Y to the pointer's low byte is what costs the cycle
+            uint16 baseAddr = ReadWordAtAddress((uint8) operand, context);
+            uint16 finalAddr = baseAddr + context->y;
             if (crossesPageBoundary != NULL) {
                 *crossesPageBoundary = ADDRESSES_ON_DIFFERENT_PAGES(baseAddr, finalAddr);
             }
             return finalAddr;
         }
         case MCS6502AddressingRelative: {
-            signed char offset = (signed char) MCS6502ReadByte(context->pc + 1, context);
+            signed char offset = (signed char) operand;
             uint16 addr = context->pc + 2 + offset;
             // all relative instructions are 2 bytes long, and we need to account for that here.
             if (crossesPageBoundary != NULL) {
@@ -1212,6 +2505,7 @@ static uint16 EffectiveOperandAddressForInstruction(MCS6502Instruction *instruct
 #undef ADDRESSES_ON_DIFFERENT_PAGES
 }
 
+#ifdef MCS6502_REFERENCE_SWITCH // Only the reference decoder uses these
 static uint8 ReadOperandValueForCurrentInstruction(MCS6502Instruction *instruction, MCS6502ExecutionContext *context) {
     if (instruction->mode == MCS6502AddressingImmediate) {
         return MCS6502ReadByte(context->pc + 1, context);
@@ -1236,9 +2530,14 @@ static void WriteResultForCurrentInstruction(uint8 result, MCS6502Instruction *i
         MCS6502WriteByte(addr, result, context);
     }
 }
+#endif
 
 static int LengthForInstruction(MCS6502Instruction *instruction) {
-    switch (instruction->mode) {
+    return LengthForMode(instruction->mode);
+}
+
+static MCS6502_ALWAYS_INLINE int LengthForMode(MCS6502AddressingMode mode) {
+    switch (mode) {
         case MCS6502AddressingImplied:
         case MCS6502AddressingAccumulator:
             return 1;
@@ -1261,6 +2560,7 @@ static int LengthForInstruction(MCS6502Instruction *instruction) {
     }
 }
 
+#ifdef MCS6502_REFERENCE_SWITCH
 static void ExecuteConditionalBranch(bool condition, MCS6502Instruction *instruction,
                                      MCS6502ExecutionContext *context) {
     if (condition) {
@@ -1275,6 +2575,7 @@ static void ExecuteConditionalBranch(bool condition, MCS6502Instruction *instruc
         context->timingForLastOperation += 2;
     }
 }
+#endif
 
 //
 // DEBUG
@@ -27,6 +27,9 @@ typedef unsigned short uint16;
 struct _MCS6502ExecutionContext;
 typedef uint8(*MCS6502DataReadByteFunction)(uint16 addr, void* readWriteContext);
 typedef void (*MCS6502DataWriteByteFunction)(uint16 addr, uint8 byte, void* readWriteContext);
+typedef bool (*MCS6502TrapFunction)(struct _MCS6502ExecutionContext* context, int cycleBudget, void* data);
+
+#define MCS6502_MAX_TRAPS 16
 
 typedef struct _MCS6502ExecutionContext {
     // CPU state (you can inspect this to debug):
@@ -36,13 +39,25 @@ typedef struct _MCS6502ExecutionContext {
     uint16 pc;      // Program counter
     uint8 p;        // Processor status
 
+    // While instructions run, N, Z, C and V are kept here instead, where setting them is
+    // a plain store, and only folded back into p when MCS6502ExecNext()/MCS6502Run()
+    // return. Between calls p is up to date and can be read or changed as usual.
+    uint8 lazyNegative; // N is bit 7
+    uint8 lazyZero;     // Z is set when this is zero
+    bool lazyCarry;
+    bool lazyOverflow;
+
     // These fields are used to track state related to tick-based emulation:
     unsigned int pendingTiming;
     unsigned int timingForLastOperation;
-    struct {
-        bool irqPending : 1;
-        bool nmiPending : 1;
+    union {
+        struct {
+            bool irqPending : 1;
+            bool nmiPending : 1;
+        };
+        uint8 interruptsPending; // Non-zero if either of the above is set, for a single check
     };
+    bool stopRequested; // See MCS6502StopRun()
 
     // The "data bus" for the CPU is represented by these function pointers.
     // The optional data access "context" pointer is passed back into the read
@@ -50,6 +65,35 @@ typedef struct _MCS6502ExecutionContext {
     MCS6502DataReadByteFunction readByte;
     MCS6502DataWriteByteFunction writeByte;
     void* readWriteContext;
+
+    // Optional memory map with one entry per 256-byte page. Accesses to a page with a
+    // non-NULL entry go straight to that memory and skip the bus functions above, so
+    // only pages left NULL (the default, e.g. I/O) pay for a function call. Set these
+    // up with the map functions below; bank switching is just remapping the pages.
+    const uint8* readPages[256];
+    uint8* writePages[256];
+    uint8 writeProtectPage[256]; // Writes to write-protected pages land here.
+
+    // Every write to a page bumps its generation, so decoded copies of code in that
+    // page can tell when they may be stale. If you change memory behind the CPU's
+    // back (e.g. loading a program), call MCS6502InvalidatePages() for it.
+    unsigned int pageWriteGenerations[256];
+
+    // Optional cache of decoded instruction blocks, see MCS6502EnableBlockCache().
+    struct _MCS6502BlockCache* blockCache;
+
+    // Optional execution counters, see MCS6502EnableCounters().
+    struct _MCS6502Counters* counters;
+    struct _MCS6502CallGraph* callGraph; // See MCS6502EnableCallGraph()
+
+    // Optional traps on instruction addresses, see MCS6502SetTrap().
+    struct {
+        uint16 address;
+        MCS6502TrapFunction function;
+        void* data;
+    } traps[MCS6502_MAX_TRAPS];
+    uint8 trapCount;
+    uint8 trapPages[256]; // Number of traps in each page
 } MCS6502ExecutionContext;
 
 //
@@ -93,6 +137,173 @@ MCS6502Init(
     void* readWriteContext
 );
 
+// Map pageCount pages starting at firstPage (the high byte of the address) so they
+// are read or written directly at the given memory, which holds the first of those
+// pages. Passing NULL unmaps them again, sending their accesses to the bus functions.
+// Write-protected pages (ROM) silently ignore writes without calling the bus.
+
+void
+MCS6502MapReadPages(
+    MCS6502ExecutionContext* context,
+    uint8 firstPage,
+    unsigned int pageCount,
+    const uint8* memory
+);
+void
+MCS6502MapWritePages(
+    MCS6502ExecutionContext* context,
+    uint8 firstPage,
+    unsigned int pageCount,
+    uint8* memory
+);
+void
+MCS6502WriteProtectPages(
+    MCS6502ExecutionContext* context,
+    uint8 firstPage,
+    unsigned int pageCount
+);
+
+void
+MCS6502InvalidatePages(
+    MCS6502ExecutionContext* context,
+    uint8 firstPage,
+    unsigned int pageCount
+);
+
+// MCS6502Run() can keep decoded blocks of straight-line code (up to the next branch,
+// jump, call or return) keyed by their start address, and execute them without
+// fetching and decoding every instruction again. Only code in directly mapped pages is
+// cached, and blocks are dropped when their page is written. Enabling allocates the
+// cache (a couple of MB) and returns false if that failed; call it after MCS6502Init()
+// and disable it to free the cache. It has no effect on MCS6502Tick/MCS6502ExecNext.
+
+bool
+MCS6502EnableBlockCache(
+    MCS6502ExecutionContext* context
+);
+void
+MCS6502DisableBlockCache(
+    MCS6502ExecutionContext* context
+);
+
+// Code translated ahead of time (see tools/rom2c.c) can be given to MCS6502Run() one
+// page at a time. The function is called with the PC in its page and returns false if
+// it has no code for that address. Otherwise it runs from there, following the same
+// rules as a cached block: it returns after an instruction that leaves the page or
+// jumps somewhere it has no code for, on a stop request, once timingForLastOperation
+// reaches the budget, or once the page's write generation no longer matches. The
+// translation is dropped when its page is written or remapped. Needs the block cache;
+// returns false without it.
+
+typedef bool (*MCS6502TranslatedPageFunction)(MCS6502ExecutionContext* context, int cycleBudget,
+                                              unsigned int generation);
+
+bool
+MCS6502SetTranslatedPage(
+    MCS6502ExecutionContext* context,
+    uint8 page,
+    MCS6502TranslatedPageFunction function
+);
+
+// A trap calls a function instead of executing the instruction at an address, e.g. to
+// run a ROM routine natively (high-level emulation). The function is called with p up
+// to date and the PC at the trap address, before the instruction there is fetched. It
+// returns false to have the instruction run as usual, or does the routine's work, sets
+// the PC, adds the cycles it wants to charge to timingForLastOperation and returns true.
+// cycleBudget is what is left of the current MCS6502Run(), INT_MAX outside of one; work
+// that takes longer can be left part done for the next run to carry on with.
+// Setting a trap replaces any other at that address and a NULL function removes it.
+// Returns false if there is no room for another trap.
+
+bool
+MCS6502SetTrap(
+    MCS6502ExecutionContext* context,
+    uint16 address,
+    MCS6502TrapFunction function,
+    void* data
+);
+
+// A build with MCS6502_COUNTERS defined can count the instructions the interpreter runs:
+// executions and cycles of each opcode with the page crossings that cost it an extra
+// cycle, and executions and cycles of the instruction at each address. While counters
+// are enabled, MCS6502Run() interprets every instruction instead of running cached or
+// translated blocks. Traps are not counted. Enabling allocates the counters, zeroed,
+// and returns false if that failed or the build has no counters; disabling frees them.
+
+typedef struct _MCS6502Counters {
+    unsigned long long opcodeExecutions[256];
+    unsigned long long opcodeCycles[256];
+    unsigned long long opcodePageCrossings[256];
+    unsigned long long pcExecutions[65536]; // By the address of the opcode
+    unsigned long long pcCycles[65536];
+} MCS6502Counters;
+
+bool
+MCS6502EnableCounters(
+    MCS6502ExecutionContext* context
+);
+void
+MCS6502DisableCounters(
+    MCS6502ExecutionContext* context
+);
+
+// The same builds can also keep a shadow call stack, pushed by JSR, BRK and interrupts
+// and popped by RTS and RTI, and give the cycles of every instruction to the chain of
+// calls it ran under. A return pops the frame whose call it goes back to; otherwise
+// frames are matched by stack pointer: a frame goes once the stack is back above its
+// return address, whatever got it there. So a routine that jumps with RTS to an
+// address it pushed keeps its frame, and frames whose return address was dropped
+// (PLA/PLA, TXS) go at the next call, return or TXS. The chains are a tree of nodes,
+// each a routine (the address called) under its caller's node; node 0 is code run
+// outside of any call. The cycles traps charge (see MCS6502SetTrap) go to the frame
+// they run in.
+
+#define MCS6502_CALL_NODES 65536
+#define MCS6502_CALL_DEPTH 256
+
+typedef struct _MCS6502CallNode {
+    uint16 routine;
+    int parent; // -1 for node 0
+    unsigned long long calls;
+    unsigned long long cycles; // In the routine itself, not the ones it called
+} MCS6502CallNode;
+
+typedef struct _MCS6502CallGraph {
+    int nodeCount;
+    MCS6502CallNode nodes[MCS6502_CALL_NODES];
+    unsigned long long lostCalls; // Left out for lack of nodes or depth, run as the caller
+
+    // The shadow stack: the node of each frame, S before it pushed its return address, and
+    // the address it returns to
+    int depth;
+    int stackNodes[MCS6502_CALL_DEPTH];
+    uint8 stackPointers[MCS6502_CALL_DEPTH];
+    uint16 returnAddresses[MCS6502_CALL_DEPTH];
+
+    int children[2 * MCS6502_CALL_NODES]; // Nodes + 1 by caller and routine, open addressing
+} MCS6502CallGraph;
+
+bool
+MCS6502EnableCallGraph(
+    MCS6502ExecutionContext* context
+);
+void
+MCS6502DisableCallGraph(
+    MCS6502ExecutionContext* context
+);
+
+// The mnemonic of an opcode ("???" if it isn't a known instruction) and the length of
+// its instruction in bytes, e.g. to report the counters. Only valid after MCS6502Init().
+
+const char*
+MCS6502OpcodeMnemonic(
+    uint8 opcode
+);
+int
+MCS6502OpcodeLength(
+    uint8 opcode
+);
+
 // The three useful hardware interrupt triggers. Call MCS6502Reset() after
 // MCS6502Init() and before a MCS6502Tick() to perform power-on reset.
 
@@ -134,6 +345,25 @@ MCS6502ExecNext(
     MCS6502ExecutionContext* context
 );
 
+//
+// For running the CPU in batches, call run instead of tick. It executes whole
+// instructions until the cycle budget is used up, and returns the budget left over.
+// That is zero or negative (the overshoot of the last instruction, which the caller
+// can take off its next budget) unless the run was cut short. A run stops early when
+// a bus function calls MCS6502StopRun(), e.g. on a soft switch the host wants to react
+// to right away, or when the opcode at the PC is not a known instruction.
+//
+
+int
+MCS6502Run(
+    MCS6502ExecutionContext* context,
+    int cycleBudget
+);
+void
+MCS6502StopRun(
+    MCS6502ExecutionContext* context
+);
+
 //
 // Important vector locations
 //
@@ -0,0 +1,1990 @@
+#pragma once
+
+#include "applesoft.h"
+#include "res/fp_basic.h"
+
+//
+// 6502 operations on an applesoft_fp_state, for transcribing ROM code. Binary mode only;
+// the traps leave decimal mode to the ROM.
+//
+
+#define ZP(address) (s->mem[(uint8_t)(address)])
+
+static inline void fp_nz(applesoft_fp_state* s, const uint8_t value) {
+    s->n = value & 0x80;
+    s->z = value == 0;
+}
+
+static inline void fp_lda(applesoft_fp_state* s, const uint8_t value) { s->a = value; fp_nz(s, value); }
+static inline void fp_ldx(applesoft_fp_state* s, const uint8_t value) { s->x = value; fp_nz(s, value); }
+static inline void fp_ldy(applesoft_fp_state* s, const uint8_t value) { s->y = value; fp_nz(s, value); }
+static inline void fp_eor(applesoft_fp_state* s, const uint8_t value) { fp_lda(s, s->a ^ value); }
+static inline void fp_ora(applesoft_fp_state* s, const uint8_t value) { fp_lda(s, s->a | value); }
+
+static inline void fp_adc(applesoft_fp_state* s, const uint8_t value) {
+    const unsigned int sum = s->a + value + s->c;
+    s->v = ~(s->a ^ value) & (s->a ^ sum) & 0x80;
+    s->c = sum > 0xFF;
+    fp_lda(s, sum);
+}
+
+static inline void fp_sbc(applesoft_fp_state* s, const uint8_t value) { fp_adc(s, ~value); }
+
+static inline void fp_compare(applesoft_fp_state* s, const uint8_t reg, const uint8_t value) {
+    s->c = reg >= value;
+    fp_nz(s, reg - value);
+}
+
+static inline void fp_bit(applesoft_fp_state* s, const uint8_t value) {
+    s->n = value & 0x80;
+    s->v = value & 0x40;
+    s->z = (s->a & value) == 0;
+}
+
+static inline void fp_asl(applesoft_fp_state* s, uint8_t* m) {
+    s->c = *m & 0x80;
+    *m <<= 1;
+    fp_nz(s, *m);
+}
+
+static inline void fp_lsr(applesoft_fp_state* s, uint8_t* m) {
+    s->c = *m & 0x01;
+    *m >>= 1;
+    fp_nz(s, *m);
+}
+
+static inline void fp_rol(applesoft_fp_state* s, uint8_t* m) {
+    const bool carry = s->c;
+    s->c = *m & 0x80;
+    *m = (uint8_t)(*m << 1) | carry;
+    fp_nz(s, *m);
+}
+
+static inline void fp_ror(applesoft_fp_state* s, uint8_t* m) {
+    const bool carry = s->c;
+    s->c = *m & 0x01;
+    *m = (*m >> 1) | (carry ? 0x80 : 0);
+    fp_nz(s, *m);
+}
+
+static inline void fp_inc(applesoft_fp_state* s, uint8_t* m) { fp_nz(s, ++*m); }
+
+static inline void fp_push(applesoft_fp_state* s, const uint8_t value) { s->mem[0x100 + s->sp--] = value; }
+static inline uint8_t fp_pull(applesoft_fp_state* s) { return s->mem[0x100 + ++s->sp]; }
+
+// JSR at the given address, pushing the return address as the 6502 would
+static inline void fp_jsr(applesoft_fp_state* s, const uint16_t address) {
+    fp_push(s, (address + 2) >> 8);
+    fp_push(s, (address + 2) & 0xFF);
+}
+
+static inline void fp_rts(applesoft_fp_state* s) {
+    const uint8_t low = fp_pull(s);
+    s->pc = (uint16_t)((low | fp_pull(s) << 8) + 1);
+}
+
+static inline void fp_php(applesoft_fp_state* s) {
+    fp_push(s, (s->p & ~(MCS6502_STATUS_N | MCS6502_STATUS_V | MCS6502_STATUS_Z | MCS6502_STATUS_C)) | 0x30 |
+               (s->n ? MCS6502_STATUS_N : 0) | (s->v ? MCS6502_STATUS_V : 0) |
+               (s->z ? MCS6502_STATUS_Z : 0) | (s->c ? MCS6502_STATUS_C : 0));
+}
+
+static inline void fp_plp(applesoft_fp_state* s) {
+    const uint8_t p = fp_pull(s);
+    s->p = p & ~(0x20 | MCS6502_STATUS_B); // As the core's PLP leaves them
+    s->n = p & MCS6502_STATUS_N;
+    s->v = p & MCS6502_STATUS_V;
+    s->z = p & MCS6502_STATUS_Z;
+    s->c = p & MCS6502_STATUS_C;
+}
+
+static inline void fp_pla(applesoft_fp_state* s) { fp_lda(s, fp_pull(s)); }
+
+// JMP ERROR ($D412) with the error code in X
+static inline void fp_error(applesoft_fp_state* s, const uint8_t code) {
+    fp_ldx(s, code);
+    s->pc = 0xD412;
+    s->error = true;
+}
+
+//
+// The floating point package. FAC is $9D (exponent), $9E-$A1 (mantissa) and $A2 (sign)
+// with an extra mantissa byte in $AC, ARG is $A5-$AA, $AB holds the sign of FAC EOR ARG
+// and $62-$65 collect products and quotients. Entry points that are also jumped into
+// in the middle take the ROM address to start at.
+//
+
+// NORMALIZE.FAC ($E82E) with its ZERO.FAC ($E84E) and carry ($E88D) tails
+static void fp_normalize_fac(applesoft_fp_state* s, const uint16_t entry) {
+    switch (entry) {
+        case 0xE84E: goto zero_fac;
+        case 0xE852: goto store_sign;
+        case 0xE88D: goto check_carry;
+        case 0xE88F: goto carry;
+        default: break;
+    }
+    fp_ldy(s, 0x00);
+    fp_lda(s, s->y);
+    s->c = false;
+byte_loop:
+    fp_ldx(s, ZP(0x9E));
+    if (!s->z) goto bit_loop_test;
+    fp_ldx(s, ZP(0x9F));
+    ZP(0x9E) = s->x;
+    fp_ldx(s, ZP(0xA0));
+    ZP(0x9F) = s->x;
+    fp_ldx(s, ZP(0xA1));
+    ZP(0xA0) = s->x;
+    fp_ldx(s, ZP(0xAC));
+    ZP(0xA1) = s->x;
+    ZP(0xAC) = s->y;
+    fp_adc(s, 0x08);
+    fp_compare(s, s->a, 0x20);
+    if (!s->z) goto byte_loop;
+zero_fac:
+    fp_lda(s, 0x00);
+    ZP(0x9D) = s->a;
+store_sign:
+    ZP(0xA2) = s->a;
+    fp_rts(s);
+    return;
+bit_loop:
+    fp_adc(s, 0x01);
+    fp_asl(s, &ZP(0xAC));
+    fp_rol(s, &ZP(0xA1));
+    fp_rol(s, &ZP(0xA0));
+    fp_rol(s, &ZP(0x9F));
+    fp_rol(s, &ZP(0x9E));
+bit_loop_test:
+    if (!s->n) goto bit_loop;
+    s->c = true;
+    fp_sbc(s, ZP(0x9D));
+    if (s->c) goto zero_fac;
+    fp_eor(s, 0xFF);
+    fp_adc(s, 0x01);
+    ZP(0x9D) = s->a;
+check_carry:
+    if (!s->c) {
+        fp_rts(s);
+        return;
+    }
+carry:
+    fp_inc(s, &ZP(0x9D));
+    if (s->z) {
+        fp_error(s, 0x45); // OVERFLOW
+        return;
+    }
+    fp_ror(s, &ZP(0x9E));
+    fp_ror(s, &ZP(0x9F));
+    fp_ror(s, &ZP(0xA0));
+    fp_ror(s, &ZP(0xA1));
+    fp_ror(s, &ZP(0xAC));
+    fp_rts(s);
+}
+
+// COMPLEMENT.FAC ($E89E), or just the mantissa increment from $E8C6
+static void fp_complement_fac(applesoft_fp_state* s, const uint16_t entry) {
+    if (entry == 0xE89E) {
+        fp_lda(s, ZP(0xA2) ^ 0xFF);
+        ZP(0xA2) = s->a;
+        for (uint8_t address = 0x9E; address <= 0xA1; address++) {
+            fp_lda(s, ZP(address) ^ 0xFF);
+            ZP(address) = s->a;
+        }
+        fp_lda(s, ZP(0xAC) ^ 0xFF);
+        ZP(0xAC) = s->a;
+        fp_inc(s, &ZP(0xAC));
+        if (!s->z) goto done;
+    }
+    for (uint8_t address = 0xA1; address >= 0x9E; address--) {
+        fp_inc(s, &ZP(address));
+        if (!s->z) break;
+    }
+done:
+    fp_rts(s);
+}
+
+// SHIFT.RIGHT ($E8F0): shift the number at X+1 right by -A bits, through $AC. Also
+// entered at $E8DA (the product at $62 by a byte) and $E907 (part way through a bit).
+static void fp_shift_right(applesoft_fp_state* s, const uint16_t entry) {
+    switch (entry) {
+        case 0xE8DA: fp_ldx(s, 0x61); goto byte_shift;
+        case 0xE907: goto bit_shift_rest;
+        default: goto next;
+    }
+byte_shift:
+    fp_ldy(s, ZP(s->x + 4));
+    ZP(0xAC) = s->y;
+    fp_ldy(s, ZP(s->x + 3));
+    ZP(s->x + 4) = s->y;
+    fp_ldy(s, ZP(s->x + 2));
+    ZP(s->x + 3) = s->y;
+    fp_ldy(s, ZP(s->x + 1));
+    ZP(s->x + 2) = s->y;
+    fp_ldy(s, ZP(0xA4));
+    ZP(s->x + 1) = s->y;
+next:
+    fp_adc(s, 0x08);
+    if (s->n || s->z) goto byte_shift;
+    fp_sbc(s, 0x08);
+    fp_ldy(s, s->a);
+    fp_lda(s, ZP(0xAC));
+    if (s->c) goto done;
+bit_shift:
+    fp_asl(s, &ZP(s->x + 1));
+    if (s->c) {
+        fp_inc(s, &ZP(s->x + 1));
+    }
+    fp_ror(s, &ZP(s->x + 1));
+    fp_ror(s, &ZP(s->x + 1));
+bit_shift_rest:
+    fp_ror(s, &ZP(s->x + 2));
+    fp_ror(s, &ZP(s->x + 3));
+    fp_ror(s, &ZP(s->x + 4));
+    fp_ror(s, &s->a);
+    fp_ldy(s, s->y + 1);
+    if (!s->z) goto bit_shift;
+done:
+    s->c = false;
+    fp_rts(s);
+}
+
+// MOVFA ($EB53): FAC = ARG
+static void fp_movfa(applesoft_fp_state* s) {
+    fp_lda(s, ZP(0xAA));
+    ZP(0xA2) = s->a;
+    fp_ldx(s, 0x05);
+    do {
+        fp_lda(s, ZP(0xA4 + s->x));
+        ZP(0x9C + s->x) = s->a;
+        fp_ldx(s, s->x - 1);
+    } while (!s->z);
+    ZP(0xAC) = s->x;
+    fp_rts(s);
+}
+
+// FADDT ($E7C1): FAC = ARG + FAC, entered with Z set if FAC is zero
+static void fp_faddt(applesoft_fp_state* s) {
+    if (s->z) {
+        fp_movfa(s);
+        return;
+    }
+    fp_ldx(s, ZP(0xAC));
+    ZP(0x92) = s->x;
+    fp_ldx(s, 0xA5);
+    fp_lda(s, ZP(0xA5));
+    fp_ldy(s, s->a);
+    if (s->z) {
+        fp_rts(s); // ARG is zero
+        return;
+    }
+    s->c = true;
+    fp_sbc(s, ZP(0x9D));
+    if (s->z) goto add_or_subtract;
+    if (s->c) {
+        // ARG is bigger: FAC gets its exponent and sign and is the one shifted
+        ZP(0x9D) = s->y;
+        fp_ldy(s, ZP(0xAA));
+        ZP(0xA2) = s->y;
+        fp_eor(s, 0xFF);
+        fp_adc(s, 0x00);
+        fp_ldy(s, 0x00);
+        ZP(0x92) = s->y;
+        fp_ldx(s, 0x9D);
+        if (!s->z) goto align;
+    }
+    fp_ldy(s, 0x00);
+    ZP(0xAC) = s->y;
+align:
+    fp_compare(s, s->a, 0xF9);
+    if (s->n) {
+        fp_jsr(s, 0xE7B9);
+        fp_shift_right(s, 0xE8F0);
+    } else {
+        fp_ldy(s, s->a);
+        fp_lda(s, ZP(0xAC));
+        fp_lsr(s, &ZP(s->x + 1));
+        fp_jsr(s, 0xE7F7);
+        fp_shift_right(s, 0xE907);
+    }
+add_or_subtract:
+    fp_bit(s, ZP(0xAB));
+    if (!s->n) {
+        fp_adc(s, ZP(0x92));
+        ZP(0xAC) = s->a;
+        fp_lda(s, ZP(0xA1)); fp_adc(s, ZP(0xA9)); ZP(0xA1) = s->a;
+        fp_lda(s, ZP(0xA0)); fp_adc(s, ZP(0xA8)); ZP(0xA0) = s->a;
+        fp_lda(s, ZP(0x9F)); fp_adc(s, ZP(0xA7)); ZP(0x9F) = s->a;
+        fp_lda(s, ZP(0x9E)); fp_adc(s, ZP(0xA6)); ZP(0x9E) = s->a;
+        fp_normalize_fac(s, 0xE88D);
+        return;
+    }
+    // Subtract the shifted one (X+1) from the other (Y+1)
+    fp_ldy(s, 0x9D);
+    fp_compare(s, s->x, 0xA5);
+    if (!s->z) {
+        fp_ldy(s, 0xA5);
+    }
+    s->c = true;
+    fp_eor(s, 0xFF);
+    fp_adc(s, ZP(0x92));
+    ZP(0xAC) = s->a;
+    for (int i = 4; i >= 1; i--) {
+        fp_lda(s, s->mem[(uint16_t)(s->y + i)]);
+        fp_sbc(s, ZP(s->x + i));
+        ZP(0x9D + i) = s->a;
+    }
+    if (!s->c) {
+        fp_jsr(s, 0xE82B);
+        fp_complement_fac(s, 0xE89E);
+    }
+    fp_normalize_fac(s, 0xE82E);
+}
+
+// ADD.EXPONENTS ($EA0E) for FMULT and FDIV. Returns true if it returned straight from
+// its caller, with FAC zero, on underflow.
+static bool fp_add_exponents(applesoft_fp_state* s) {
+    fp_lda(s, ZP(0xA5));
+    if (s->z) goto underflow;
+    s->c = false;
+    fp_adc(s, ZP(0x9D));
+    if (!s->c) {
+        if (!s->n) goto underflow;
+    } else {
+        if (s->n) {
+            fp_error(s, 0x45); // OVERFLOW
+            return true;
+        }
+        s->c = false;
+        fp_bit(s, s->mem[0x1410]); // Skips the BPL in its operand
+    }
+    fp_adc(s, 0x80);
+    ZP(0x9D) = s->a;
+    if (s->z) {
+        fp_normalize_fac(s, 0xE852);
+        return false;
+    }
+    fp_lda(s, ZP(0xAB));
+    ZP(0xA2) = s->a;
+    fp_rts(s);
+    return false;
+underflow:
+    fp_pla(s);
+    fp_pla(s);
+    fp_normalize_fac(s, 0xE84E);
+    return true;
+}
+
+// MULTIPLY.1 ($E9B0): add ARG times the bits of A into the product, or MULTIPLY.2 ($E9B5)
+static void fp_multiply(applesoft_fp_state* s, const uint16_t entry) {
+    if (entry == 0xE9B0 && s->z) {
+        fp_shift_right(s, 0xE8DA);
+        return;
+    }
+    fp_lsr(s, &s->a);
+    fp_ora(s, 0x80);
+    do {
+        fp_ldy(s, s->a);
+        if (s->c) {
+            s->c = false;
+            fp_lda(s, ZP(0x65)); fp_adc(s, ZP(0xA9)); ZP(0x65) = s->a;
+            fp_lda(s, ZP(0x64)); fp_adc(s, ZP(0xA8)); ZP(0x64) = s->a;
+            fp_lda(s, ZP(0x63)); fp_adc(s, ZP(0xA7)); ZP(0x63) = s->a;
+            fp_lda(s, ZP(0x62)); fp_adc(s, ZP(0xA6)); ZP(0x62) = s->a;
+        }
+        fp_ror(s, &ZP(0x62));
+        fp_ror(s, &ZP(0x63));
+        fp_ror(s, &ZP(0x64));
+        fp_ror(s, &ZP(0x65));
+        fp_ror(s, &ZP(0xAC));
+        fp_lda(s, s->y);
+        fp_lsr(s, &s->a);
+    } while (!s->z);
+    fp_rts(s);
+}
+
+// $EAE6: FAC = the product or quotient, normalized
+static void fp_copy_result(applesoft_fp_state* s) {
+    for (int i = 0; i < 4; i++) {
+        fp_lda(s, ZP(0x62 + i));
+        ZP(0x9E + i) = s->a;
+    }
+    fp_normalize_fac(s, 0xE82E);
+}
+
+// FMULTT ($E982): FAC = ARG * FAC, entered with Z set if FAC is zero
+static void fp_fmultt(applesoft_fp_state* s) {
+    if (s->z) {
+        fp_rts(s);
+        return;
+    }
+    fp_jsr(s, 0xE987);
+    if (fp_add_exponents(s) || s->error) {
+        return;
+    }
+    fp_lda(s, 0x00);
+    ZP(0x62) = ZP(0x63) = ZP(0x64) = ZP(0x65) = s->a;
+    static const uint8_t bytes[] = {0xAC, 0xA1, 0xA0, 0x9F};
+    for (int i = 0; i < 4; i++) {
+        fp_lda(s, ZP(bytes[i]));
+        fp_jsr(s, 0xE996 + 5 * i);
+        fp_multiply(s, 0xE9B0);
+    }
+    fp_lda(s, ZP(0x9E));
+    fp_jsr(s, 0xE9AA);
+    fp_multiply(s, 0xE9B5);
+    fp_copy_result(s);
+}
+
+// ROUND.FAC ($EB72): round the mantissa up by the top bit of $AC
+static void fp_round_fac(applesoft_fp_state* s) {
+    fp_lda(s, ZP(0x9D));
+    if (s->z) {
+        fp_rts(s);
+        return;
+    }
+    fp_asl(s, &ZP(0xAC));
+    if (!s->c) {
+        fp_rts(s);
+        return;
+    }
+    fp_jsr(s, 0xEB7A);
+    fp_complement_fac(s, 0xE8C6);
+    if (!s->z) {
+        fp_rts(s);
+        return;
+    }
+    fp_normalize_fac(s, 0xE88F);
+}
+
+// FDIVT ($EA69): FAC = ARG / FAC, entered with Z set if FAC is zero
+static void fp_fdivt(applesoft_fp_state* s) {
+    if (s->z) {
+        fp_error(s, 0x85); // DIVISION BY ZERO
+        return;
+    }
+    fp_jsr(s, 0xEA6B);
+    fp_round_fac(s);
+    if (s->error) {
+        return;
+    }
+    fp_lda(s, 0x00);
+    s->c = true;
+    fp_sbc(s, ZP(0x9D));
+    ZP(0x9D) = s->a;
+    fp_jsr(s, 0xEA75);
+    if (fp_add_exponents(s) || s->error) {
+        return;
+    }
+    fp_inc(s, &ZP(0x9D));
+    if (s->z) {
+        fp_error(s, 0x45); // OVERFLOW
+        return;
+    }
+
+    // Long division of ARG by FAC, a quotient bit at a time into $62-$66
+    fp_ldx(s, 0xFC);
+    fp_lda(s, 0x01);
+compare:
+    fp_ldy(s, ZP(0xA6));
+    fp_compare(s, s->y, ZP(0x9E));
+    if (s->z) {
+        fp_ldy(s, ZP(0xA7));
+        fp_compare(s, s->y, ZP(0x9F));
+        if (s->z) {
+            fp_ldy(s, ZP(0xA8));
+            fp_compare(s, s->y, ZP(0xA0));
+            if (s->z) {
+                fp_ldy(s, ZP(0xA9));
+                fp_compare(s, s->y, ZP(0xA1));
+            }
+        }
+    }
+quotient_bit:
+    fp_php(s);
+    fp_rol(s, &s->a);
+    if (s->c) {
+        fp_ldx(s, s->x + 1);
+        ZP(0x65 + s->x) = s->a;
+        if (s->z) {
+            fp_lda(s, 0x40); // Two more bits, for rounding
+        } else if (!s->n) {
+            // Done
+            fp_asl(s, &s->a);
+            fp_asl(s, &s->a);
+            fp_asl(s, &s->a);
+            fp_asl(s, &s->a);
+            fp_asl(s, &s->a);
+            fp_asl(s, &s->a);
+            ZP(0xAC) = s->a;
+            fp_plp(s);
+            fp_copy_result(s);
+            return;
+        } else {
+            fp_lda(s, 0x01);
+        }
+    }
+    fp_plp(s);
+    if (s->c) {
+        fp_ldy(s, s->a);
+        fp_lda(s, ZP(0xA9)); fp_sbc(s, ZP(0xA1)); ZP(0xA9) = s->a;
+        fp_lda(s, ZP(0xA8)); fp_sbc(s, ZP(0xA0)); ZP(0xA8) = s->a;
+        fp_lda(s, ZP(0xA7)); fp_sbc(s, ZP(0x9F)); ZP(0xA7) = s->a;
+        fp_lda(s, ZP(0xA6)); fp_sbc(s, ZP(0x9E)); ZP(0xA6) = s->a;
+        fp_lda(s, s->y);
+    }
+    fp_asl(s, &ZP(0xA9));
+    fp_rol(s, &ZP(0xA8));
+    fp_rol(s, &ZP(0xA7));
+    fp_rol(s, &ZP(0xA6));
+    if (s->c) goto quotient_bit;
+    if (s->n) goto compare;
+    goto quotient_bit;
+}
+
+/**
+ * Runs the routine at the state's PC on its memory, up to its RTS or a jump to ERROR,
+ * and returns the cycles to charge.
+ */
+static int applesoft_fp_run(applesoft_fp_state* s) {
+    switch (s->pc) {
+        case APPLESOFT_FADDT: fp_faddt(s); return APPLESOFT_FADD_CYCLES;
+        case APPLESOFT_FMULTT: fp_fmultt(s); return APPLESOFT_FMULT_CYCLES;
+        default: fp_fdivt(s); return APPLESOFT_FDIV_CYCLES;
+    }
+}
+
+static void applesoft_fp_load(applesoft_fp_state* s, const MCS6502ExecutionContext* cpu, uint8_t* memory) {
+    *s = (applesoft_fp_state){
+        .mem = memory,
+        .a = cpu->a, .x = cpu->x, .y = cpu->y, .sp = cpu->sp,
+        .n = cpu->p & MCS6502_STATUS_N, .z = cpu->p & MCS6502_STATUS_Z,
+        .c = cpu->p & MCS6502_STATUS_C, .v = cpu->p & MCS6502_STATUS_V,
+        .p = cpu->p,
+        .pc = cpu->pc,
+    };
+}
+
+static void applesoft_fp_store(const applesoft_fp_state* s, MCS6502ExecutionContext* cpu) {
+    cpu->a = s->a;
+    cpu->x = s->x;
+    cpu->y = s->y;
+    cpu->sp = s->sp;
+    cpu->p = s->p & ~(MCS6502_STATUS_N | MCS6502_STATUS_Z | MCS6502_STATUS_C | MCS6502_STATUS_V);
+    cpu->p |= (s->n ? MCS6502_STATUS_N : 0) | (s->z ? MCS6502_STATUS_Z : 0) |
+              (s->c ? MCS6502_STATUS_C : 0) | (s->v ? MCS6502_STATUS_V : 0);
+    cpu->pc = s->pc;
+}
+
+static bool applesoft_fp_trap(MCS6502ExecutionContext* cpu, int cycle_budget, void* data) {
+    if (cpu->p & MCS6502_STATUS_D) {
+        return false;
+    }
+    applesoft_fp_state s;
+    applesoft_fp_load(&s, cpu, data);
+    const int cycles = applesoft_fp_run(&s);
+    applesoft_fp_store(&s, cpu);
+    MCS6502InvalidatePages(cpu, 0x00, 2); // The zero page and stack
+    cpu->timingForLastOperation += cycles;
+    return true;
+}
+
+#if defined(APPLESOFT_CHECK_FP) || defined(APPLESOFT_CHECK_GARBAG) || defined(APPLESOFT_CHECK_FNDLIN) || \
+    defined(APPLESOFT_CHECK_PTRGET) || defined(APPLESOFT_CHECK_PARSE)
+// A bus for running the ROM on scratch memory in the checks
+static uint8_t* check_memory;
+static uint8_t check_read(uint16_t address, void* context) { return check_memory[address]; }
+static void check_write(uint16_t address, uint8_t value, void* context) { check_memory[address] = value; }
+#endif
+
+#ifdef APPLESOFT_CHECK_FP
+
+/**
+ * Runs random FAC and ARG values through each routine natively and on the ROM, and
+ * reports any difference in memory, registers or flags to stderr. Returns the number
+ * of differences.
+ */
+static int applesoft_check_fp(const uint8_t* memory) {
+    static uint8_t rom_memory[0x10000], native_memory[0x10000];
+    static const uint16_t entries[] = {APPLESOFT_FADDT, APPLESOFT_FMULTT, APPLESOFT_FDIVT};
+    MCS6502ExecutionContext cpu;
+    int failures = 0;
+    srand(6502);
+    for (int round = 0; round < 30000; round++) {
+        memcpy(rom_memory, memory, sizeof(rom_memory));
+        for (int address = 0x62; address <= 0xAC; address++) {
+            rom_memory[address] = rand();
+        }
+        // Mostly normalized numbers of similar size, sometimes anything at all
+        if (rand() % 4) {
+            rom_memory[0x9E] |= 0x80;
+            rom_memory[0xA6] |= 0x80;
+            rom_memory[0xA5] = rom_memory[0x9D] + rand() % 48 - 24;
+        }
+        if (rand() % 16 == 0) {
+            rom_memory[rand() % 2 ? 0x9D : 0xA5] = 0;
+        }
+        rom_memory[0xAB] = rom_memory[0xA2] ^ rom_memory[0xAA];
+        memcpy(native_memory, rom_memory, sizeof(native_memory));
+        const uint8_t* fac = &rom_memory[0x9D];
+        const uint8_t* arg = &rom_memory[0xA5];
+
+        // Call the routine from a JSR at $0300, with FAC's exponent in A as the ROM does
+        MCS6502Init(&cpu, check_read, check_write, NULL);
+        rom_memory[0x1F0] = native_memory[0x1F0] = 0x03;
+        rom_memory[0x1EF] = native_memory[0x1EF] = 0x02;
+        cpu.sp = 0xEE;
+        cpu.pc = entries[round % 3];
+        cpu.a = rom_memory[0x9D];
+        cpu.x = rand();
+        cpu.y = rand();
+        cpu.p = 0x20 | (rand() & (MCS6502_STATUS_C | MCS6502_STATUS_V)) | (cpu.a ? 0 : MCS6502_STATUS_Z) |
+                (cpu.a & 0x80 ? MCS6502_STATUS_N : 0);
+        const MCS6502ExecutionContext start = cpu;
+
+        applesoft_fp_state s;
+        applesoft_fp_load(&s, &cpu, native_memory);
+        applesoft_fp_run(&s);
+
+        check_memory = rom_memory;
+        for (int steps = 0; cpu.pc != 0x0303 && cpu.pc != 0xD412 && steps < 100000; steps++) {
+            MCS6502ExecNext(&cpu);
+        }
+        MCS6502ExecutionContext native = start;
+        applesoft_fp_store(&s, &native);
+        if (cpu.pc != native.pc || cpu.a != native.a || cpu.x != native.x || cpu.y != native.y ||
+            cpu.sp != native.sp || cpu.p != native.p || memcmp(rom_memory, native_memory, 0x200) != 0) {
+            if (failures++ < 10) {
+                fprintf(stderr, "FP check: $%04X FAC %02X%02X%02X%02X%02X%02X ARG %02X%02X%02X%02X%02X%02X: "
+                                "ROM PC=%04X A=%02X X=%02X Y=%02X P=%02X, native PC=%04X A=%02X X=%02X Y=%02X P=%02X\n",
+                        start.pc, fac[0], fac[1], fac[2], fac[3], fac[4], fac[5],
+                        arg[0], arg[1], arg[2], arg[3], arg[4], arg[5],
+                        cpu.pc, cpu.a, cpu.x, cpu.y, cpu.p, native.pc, native.a, native.x, native.y, native.p);
+            }
+        }
+    }
+    return failures;
+}
+#endif
+
+/**
+ * Traps FADDT, FMULTT and FDIVT if the given memory, which the CPU runs from, holds
+ * FP_BASIC_ROM's floating point package.
+ */
+bool applesoft_install_fast_fp(MCS6502ExecutionContext* context, uint8_t* memory) {
+    if (memcmp(&memory[0xE7A0], &FP_BASIC_ROM[0xE7A0 - 0xD000], 0xEB90 - 0xE7A0) != 0) {
+        return false;
+    }
+    MCS6502SetTrap(context, APPLESOFT_FADDT, applesoft_fp_trap, memory);
+    MCS6502SetTrap(context, APPLESOFT_FMULTT, applesoft_fp_trap, memory);
+    MCS6502SetTrap(context, APPLESOFT_FDIVT, applesoft_fp_trap, memory);
+    return true;
+}
+
+//
+// String space. A string descriptor is a length and an address. GARBAG looks for them in
+// the temporary descriptors ($55 up to TEMPPT), the simple variables (seven bytes each
+// from VARTAB to ARYTAB, the descriptor after the name) and the elements of string
+// arrays (ARYTAB to STREND). On each pass it picks the highest string below FRETOP and
+// at or above STREND (the last one found of those at the same address), moves it up to
+// end at FRETOP with BLTU2, and starts again with FRETOP at its new address.
+//
+
+#define AS_TEMPPT 0x52
+#define AS_VARTAB 0x69
+#define AS_ARYTAB 0x6B
+#define AS_STREND 0x6D
+#define AS_MEMSIZ 0x73
+#define AS_DSCLEN 0x8F
+
+typedef struct {
+    uint16_t pointer; // The temporary, variable or array element, as GARBAG keeps it in $8A
+    uint8_t offset; // Of the descriptor from pointer
+    uint8_t length;
+    uint16_t address;
+} garbag_descriptor;
+
+// Descriptors take at least three bytes, and all of them are below $C000
+#define GARBAG_MAX_DESCRIPTORS (0xC000 / 3)
+static garbag_descriptor garbag_descriptors[GARBAG_MAX_DESCRIPTORS];
+static garbag_descriptor garbag_sort_buffer[GARBAG_MAX_DESCRIPTORS];
+
+static inline uint16_t as_word(const uint8_t* memory, const uint16_t address) {
+    return memory[address] | memory[(uint16_t)(address + 1)] << 8;
+}
+
+// Adds the descriptor at pointer + offset if GARBAG could ever move its string
+static bool garbag_add(const uint8_t* memory, int* count, const uint16_t pointer, const uint8_t offset) {
+    const garbag_descriptor descriptor = {
+        .pointer = pointer,
+        .offset = offset,
+        .length = memory[pointer + offset],
+        .address = as_word(memory, pointer + offset + 1),
+    };
+    if (descriptor.length == 0 || descriptor.address < as_word(memory, AS_STREND) ||
+        descriptor.address >= as_word(memory, AS_MEMSIZ)) {
+        return true;
+    }
+    if (*count == GARBAG_MAX_DESCRIPTORS) {
+        return false;
+    }
+    garbag_descriptors[(*count)++] = descriptor;
+    return true;
+}
+
+/**
+ * Collects the descriptors in the order GARBAG scans them. Returns false, leaving the
+ * collection to the ROM, if the pointers are out of order, the tables are not made of
+ * whole entries (where the ROM's scans would run off), or they reach I/O space.
+ */
+static bool garbag_collect(const uint8_t* memory, int* count) {
+    *count = 0;
+    const uint8_t temppt = memory[AS_TEMPPT];
+    if (temppt < 0x55 || temppt > 0x5E || (temppt - 0x55) % 3 != 0 ||
+        (temppt != 0x55 && memory[AS_DSCLEN] != 3)) { // The temporaries are stepped through by DSCLEN
+        return false;
+    }
+    for (uint16_t pointer = 0x55; pointer != temppt; pointer += 3) {
+        garbag_add(memory, count, pointer, 0);
+    }
+
+    const uint16_t vartab = as_word(memory, AS_VARTAB);
+    const uint16_t arytab = as_word(memory, AS_ARYTAB);
+    const uint16_t strend = as_word(memory, AS_STREND);
+    const uint16_t memsiz = as_word(memory, AS_MEMSIZ);
+    if (vartab < 0x100 || vartab > arytab || arytab > strend || strend > memsiz || memsiz > 0xC000 ||
+        (arytab - vartab) % 7 != 0) {
+        return false;
+    }
+    // String variables have a positive first and negative second name byte
+    for (uint16_t pointer = vartab; pointer != arytab; pointer += 7) {
+        if (!(memory[pointer] & 0x80) && (memory[pointer + 1] & 0x80) && !garbag_add(memory, count, pointer, 2)) {
+            return false;
+        }
+    }
+    for (uint16_t array = arytab; array != strend;) {
+        const uint16_t next = array + as_word(memory, array + 2);
+        if (next <= array || next > strend) {
+            return false;
+        }
+        if (!(memory[array] & 0x80) && (memory[array + 1] & 0x80)) {
+            // The elements follow the name, size, dimension count and dimensions; this is
+            // the ROM's sum, which adds its carries into the low byte
+            const uint8_t dimensions = memory[array + 4];
+            unsigned int sum = (uint8_t)(dimensions << 1) + 5 + (dimensions >> 7);
+            sum = (sum & 0xFF) + (array & 0xFF) + (sum >> 8);
+            uint16_t element = (array & 0xFF00) + sum;
+            if (element > next || (next - element) % 3 != 0) {
+                return false;
+            }
+            for (; element != next; element += 3) {
+                if (!garbag_add(memory, count, element, 0)) {
+                    return false;
+                }
+            }
+        }
+        array = next;
+    }
+    return true;
+}
+
+// Sorts the descriptors by address, keeping scan order between equal addresses, with two
+// byte-wide counting passes
+static void garbag_sort(const int count) {
+    garbag_descriptor* from = garbag_descriptors;
+    garbag_descriptor* to = garbag_sort_buffer;
+    for (int shift = 0; shift < 16; shift += 8) {
+        int start[257] = {0};
+        for (int i = 0; i < count; i++) {
+            start[((from[i].address >> shift) & 0xFF) + 1]++;
+        }
+        for (int digit = 0; digit < 256; digit++) {
+            start[digit + 1] += start[digit];
+        }
+        for (int i = 0; i < count; i++) {
+            to[start[(from[i].address >> shift) & 0xFF]++] = from[i];
+        }
+        garbag_descriptor* swap = from;
+        from = to;
+        to = swap;
+    }
+}
+
+/**
+ * Does the moves of GARBAG's passes, in the order its scans would pick the strings, and
+ * leaves the CPU at $E488 the way the last of them does, for the ROM to make the final
+ * pass that finds nothing more to move (or a temporary, where it gives up).
+ */
+static bool applesoft_garbag_trap(MCS6502ExecutionContext* cpu, int cycle_budget, void* data) {
+    uint8_t* memory = data;
+    int count;
+    if ((cpu->p & MCS6502_STATUS_D) || !garbag_collect(memory, &count)) {
+        return false;
+    }
+    garbag_sort(count);
+
+    const uint16_t strend = as_word(memory, AS_STREND);
+    uint16_t fretop = as_word(memory, AS_MEMSIZ);
+    const garbag_descriptor* last = NULL;
+    int moved = 0;
+    for (int i = count - 1; i >= 0; i--) {
+        const garbag_descriptor* descriptor = &garbag_descriptors[i];
+        if (descriptor->address >= fretop) {
+            continue;
+        }
+        // Stop at a temporary, or at a string the ROM would copy over the variables or
+        // from I/O space, and let the ROM carry on from there
+        if (descriptor->pointer < 0x100 || fretop - descriptor->length < strend ||
+            descriptor->address + descriptor->length > 0xC000) {
+            break;
+        }
+        const uint16_t address = fretop - descriptor->length;
+        for (int y = descriptor->length - 1; y >= 0; y--) { // BLTU2 copies downwards
+            memory[address + y] = memory[descriptor->address + y];
+        }
+        memory[descriptor->pointer + descriptor->offset + 1] = address;
+        memory[descriptor->pointer + descriptor->offset + 2] = address >> 8;
+        fretop = address;
+        last = descriptor;
+        moved++;
+    }
+    if (!last) {
+        return false; // One pass, as quick on the ROM
+    }
+
+    // What the last move leaves that the final pass doesn't set again: BLTU2's pointers,
+    // the descriptor found, JSR BLTU2's return address, and the flags of its last SBC
+    const uint8_t before = fretop + last->length;
+    memory[0x8A] = last->pointer;
+    memory[0x91] = last->offset;
+    memory[0x96] = last->address;
+    memory[0x97] = (last->address >> 8) - 1;
+    memory[0x100 + cpu->sp] = 0xE5;
+    memory[0x100 + (uint8_t)(cpu->sp - 1)] = 0x84;
+    cpu->a = fretop >> 8;
+    cpu->x = fretop;
+    cpu->y = last->offset + 2;
+    const uint8_t difference = before - last->length;
+    cpu->p &= ~(MCS6502_STATUS_N | MCS6502_STATUS_Z | MCS6502_STATUS_C | MCS6502_STATUS_V);
+    cpu->p |= (cpu->a & 0x80 ? MCS6502_STATUS_N : 0) | (cpu->a ? 0 : MCS6502_STATUS_Z) |
+              (before >= last->length ? MCS6502_STATUS_C : 0) |
+              ((before ^ last->length) & (before ^ difference) & 0x80 ? MCS6502_STATUS_V : 0);
+    cpu->pc = 0xE488;
+
+    const uint16_t vartab = as_word(memory, AS_VARTAB);
+    MCS6502InvalidatePages(cpu, 0x00, 2);
+    MCS6502InvalidatePages(cpu, vartab >> 8, ((as_word(memory, AS_MEMSIZ) - 1) >> 8) - (vartab >> 8) + 1);
+    cpu->timingForLastOperation += moved * APPLESOFT_GARBAG_CYCLES_PER_STRING;
+    return true;
+}
+
+#ifdef APPLESOFT_CHECK_GARBAG
+// Fills the descriptor at address with a random string, mostly in string space
+static void check_garbag_string(uint8_t* memory, const uint16_t address, const uint16_t strend, const uint16_t memsiz,
+                                uint16_t* strings, int* string_count) {
+    uint16_t string;
+    const int length = rand() % 8 ? 1 + rand() % 40 : rand() % 256;
+    switch (rand() % 16) {
+        case 0: string = 0x0801 + rand() % 0x100; break; // In the program
+        case 1: string = *string_count ? strings[rand() % *string_count] : strend; break; // Shared
+        case 2: string = strend + rand() % (memsiz - strend + 16); break; // Anywhere
+        default: string = strend + rand() % (memsiz - strend); break;
+    }
+    strings[(*string_count)++] = string;
+    memory[address] = length;
+    memory[address + 1] = string;
+    memory[address + 2] = string >> 8;
+}
+
+/**
+ * Runs GARBAG natively and on the ROM on random variables, arrays and temporaries, and
+ * reports any difference in memory, registers or flags to stderr. Returns the number of
+ * differences.
+ */
+static int applesoft_check_garbag(const uint8_t* memory) {
+    static uint8_t rom_memory[0x10000], native_memory[0x10000];
+    static uint16_t strings[0x400];
+    MCS6502ExecutionContext cpu;
+    int failures = 0;
+    srand(6502);
+    for (int round = 0; round < 500; round++) {
+        memcpy(rom_memory, memory, sizeof(rom_memory));
+        for (int address = 0; address < 0x200; address++) {
+            rom_memory[address] = rand();
+        }
+        for (int address = 0x800; address < 0x9600; address++) {
+            rom_memory[address] = rand();
+        }
+        int string_count = 0;
+        const uint16_t vartab = 0x0900 + rand() % 0x100;
+        const int variables = rand() % 40;
+        uint16_t strend = vartab + 7 * variables;
+        const uint16_t memsiz = 0x9600 - rand() % 0x100;
+        const uint16_t space = 0x0D00 + rand() % 0x1000; // Past the variables and arrays
+
+        for (int i = 0; i < variables; i++) {
+            const uint16_t variable = vartab + 7 * i;
+            if (rand() % 2) {
+                rom_memory[variable] &= 0x7F;
+                rom_memory[variable + 1] |= 0x80;
+                check_garbag_string(rom_memory, variable + 2, space, memsiz, strings, &string_count);
+            }
+        }
+        const uint16_t arytab = strend;
+        for (int arrays = rand() % 5; arrays > 0; arrays--) {
+            const int dimensions = 1 + rand() % 3;
+            const int elements = rand() % 40;
+            const uint16_t size = 5 + 2 * dimensions + 3 * elements;
+            rom_memory[strend] = rand() & 0x7F;
+            rom_memory[strend + 1] = rand() | (rand() % 4 ? 0x80 : 0);
+            rom_memory[strend + 2] = size;
+            rom_memory[strend + 3] = size >> 8;
+            rom_memory[strend + 4] = dimensions;
+            if (rom_memory[strend + 1] & 0x80) {
+                for (int i = 0; i < elements; i++) {
+                    check_garbag_string(rom_memory, strend + 5 + 2 * dimensions + 3 * i, space, memsiz, strings,
+                                        &string_count);
+                }
+            }
+            strend += size;
+        }
+        // A numeric array up to string space
+        rom_memory[strend] = 'A';
+        rom_memory[strend + 1] = 0;
+        rom_memory[strend + 2] = space - strend;
+        rom_memory[strend + 3] = (space - strend) >> 8;
+        rom_memory[strend + 4] = 1;
+        const int temporaries = rand() % 4 ? 0 : 1 + rand() % 3;
+        for (int i = 0; i < temporaries; i++) {
+            check_garbag_string(rom_memory, 0x55 + 3 * i, space, memsiz, strings, &string_count);
+        }
+        rom_memory[AS_TEMPPT] = 0x55 + 3 * temporaries;
+        rom_memory[AS_DSCLEN] = 3;
+        rom_memory[AS_VARTAB] = vartab;
+        rom_memory[AS_VARTAB + 1] = vartab >> 8;
+        rom_memory[AS_ARYTAB] = arytab;
+        rom_memory[AS_ARYTAB + 1] = arytab >> 8;
+        rom_memory[AS_STREND] = space;
+        rom_memory[AS_STREND + 1] = space >> 8;
+        rom_memory[AS_MEMSIZ] = memsiz;
+        rom_memory[AS_MEMSIZ + 1] = memsiz >> 8;
+        memcpy(native_memory, rom_memory, sizeof(native_memory));
+
+        // Call GARBAG from a JSR at $0300
+        MCS6502Init(&cpu, check_read, check_write, NULL);
+        rom_memory[0x1F0] = native_memory[0x1F0] = 0x03;
+        rom_memory[0x1EF] = native_memory[0x1EF] = 0x02;
+        cpu.sp = 0xEE;
+        cpu.pc = APPLESOFT_GARBAG;
+        cpu.a = rand();
+        cpu.x = rand();
+        cpu.y = rand();
+        cpu.p = 0x20 | (rand() & (MCS6502_STATUS_N | MCS6502_STATUS_Z | MCS6502_STATUS_C | MCS6502_STATUS_V));
+        MCS6502ExecutionContext native = cpu;
+
+        check_memory = rom_memory;
+        while (cpu.pc != 0x0303) {
+            MCS6502ExecNext(&cpu);
+        }
+        check_memory = native_memory;
+        applesoft_garbag_trap(&native, INT_MAX, native_memory);
+        while (native.pc != 0x0303) {
+            MCS6502ExecNext(&native);
+        }
+        if (cpu.a != native.a || cpu.x != native.x || cpu.y != native.y || cpu.sp != native.sp ||
+            cpu.p != native.p || memcmp(rom_memory, native_memory, sizeof(rom_memory)) != 0) {
+            if (failures++ < 10) {
+                int address = 0;
+                while (rom_memory[address] == native_memory[address]) {
+                    address++;
+                }
+                fprintf(stderr, "GARBAG check: round %d: ROM A=%02X X=%02X Y=%02X P=%02X, native A=%02X X=%02X "
+                                "Y=%02X P=%02X, first difference at $%04X\n",
+                        round, cpu.a, cpu.x, cpu.y, cpu.p, native.a, native.x, native.y, native.p, address);
+            }
+        }
+    }
+    return failures;
+}
+#endif
+
+/**
+ * Traps GARBAG if the given memory, which the CPU runs from, holds FP_BASIC_ROM's string
+ * space code.
+ */
+bool applesoft_install_fast_garbag(MCS6502ExecutionContext* context, uint8_t* memory) {
+    if (memcmp(&memory[0xE484], &FP_BASIC_ROM[0xE484 - 0xD000], 0xE597 - 0xE484) != 0 ||
+        memcmp(&memory[0xD39A], &FP_BASIC_ROM[0xD39A - 0xD000], 0xD3D6 - 0xD39A) != 0) {
+        return false;
+    }
+    return MCS6502SetTrap(context, APPLESOFT_GARBAG, applesoft_garbag_trap, memory);
+}
+
+//
+// Line numbers. A program line is the address of the next line, the line number and the
+// tokens up to a 0; the end of the program is a link with a zero high byte. FNDLIN
+// follows the links until a line's number is LINNUM or more, or the end, leaves it in
+// LOWTR and sets the carry if the number was LINNUM.
+//
+
+#define AS_LINNUM 0x50
+#define AS_TXTTAB 0x67
+#define AS_LOWTR 0x9B
+
+typedef struct {
+    uint16_t address;
+    uint16_t number;
+} line_index_entry;
+
+// Lines take at least five bytes, and all of them are below $C000
+#define LINE_INDEX_MAX_LINES (0xC000 / 5)
+static struct {
+    bool built;
+    int count; // Of lines, followed by the end of the program
+    line_index_entry lines[LINE_INDEX_MAX_LINES + 1];
+    uint8_t first_page, last_page;
+    unsigned int generations[256]; // Of the pages first_page to last_page when last checked
+} line_index;
+
+/**
+ * Indexes the program at TXTTAB. Returns false, leaving FNDLIN to the ROM, unless the
+ * lines go up in memory and in line number and stay clear of I/O space.
+ */
+static bool line_index_build(const MCS6502ExecutionContext* cpu, const uint8_t* memory) {
+    line_index.built = false;
+    uint16_t address = as_word(memory, AS_TXTTAB);
+    for (int count = 0;; count++) {
+        if (count > LINE_INDEX_MAX_LINES || address > 0xC000 - 4) {
+            return false;
+        }
+        line_index_entry* line = &line_index.lines[count];
+        line->address = address;
+        if (memory[address + 1] == 0) {
+            line_index.count = count;
+            break;
+        }
+        line->number = as_word(memory, address + 2);
+        const uint16_t next = as_word(memory, address);
+        if (next <= address || (count > 0 && line->number < line[-1].number)) {
+            return false;
+        }
+        address = next;
+    }
+    line_index.first_page = line_index.lines[0].address >> 8;
+    line_index.last_page = (address + 1) >> 8;
+    for (int page = line_index.first_page; page <= line_index.last_page; page++) {
+        line_index.generations[page] = cpu->pageWriteGenerations[page];
+    }
+    line_index.built = true;
+    return true;
+}
+
+// The first entry at or after address
+static int line_index_at(const unsigned int address) {
+    int low = 0, high = line_index.count + 1;
+    while (low < high) {
+        const int middle = (low + high) / 2;
+        if (line_index.lines[middle].address < address) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+    return low;
+}
+
+/**
+ * Returns whether the index still describes the program: on each page written since it
+ * was last checked, the links and line numbers (which are all FNDLIN reads) must be as
+ * they were. Writes to the rest of the lines, or to variables sharing the last page,
+ * leave the index alone.
+ */
+static bool line_index_current(const MCS6502ExecutionContext* cpu, const uint8_t* memory) {
+    if (!line_index.built || line_index.lines[0].address != as_word(memory, AS_TXTTAB)) {
+        return false;
+    }
+    for (int page = line_index.first_page; page <= line_index.last_page; page++) {
+        if (cpu->pageWriteGenerations[page] == line_index.generations[page]) {
+            continue;
+        }
+        for (int i = line_index_at(page * 0x100 - 3); i <= line_index.count; i++) {
+            const line_index_entry* line = &line_index.lines[i];
+            if (line->address > page * 0x100 + 0xFF) {
+                break;
+            }
+            if (i == line_index.count ? memory[line->address + 1] != 0
+                                      : memory[line->address + 1] == 0 || as_word(memory, line->address) != line[1].address ||
+                                            as_word(memory, line->address + 2) != line->number) {
+                return false;
+            }
+        }
+        line_index.generations[page] = cpu->pageWriteGenerations[page];
+    }
+    return true;
+}
+
+/**
+ * Finds the line FNDLIN would, from TXTTAB or the line at A/X, and returns with the
+ * registers and flags of the ROM's exit: from the CMP of the line number byte that
+ * stopped it, or the load of the zero link and CLC at the end.
+ */
+static bool applesoft_fndlin_trap(MCS6502ExecutionContext* cpu, int cycle_budget, void* data) {
+    uint8_t* memory = data;
+    if (!line_index_current(cpu, memory) && !line_index_build(cpu, memory)) {
+        return false;
+    }
+    const uint16_t start = cpu->pc == APPLESOFT_FNDLIN ? as_word(memory, AS_TXTTAB) : cpu->a | cpu->x << 8;
+    int low = line_index_at(start);
+    if (low > line_index.count || line_index.lines[low].address != start) {
+        return false; // Not the start of a line
+    }
+    const uint16_t linnum = as_word(memory, AS_LINNUM);
+    int high = line_index.count;
+    while (low < high) {
+        const int middle = (low + high) / 2;
+        if (line_index.lines[middle].number < linnum) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+    const line_index_entry* line = &line_index.lines[low];
+
+    memory[AS_LOWTR] = line->address;
+    memory[AS_LOWTR + 1] = line->address >> 8;
+    MCS6502InvalidatePages(cpu, 0x00, 1);
+    cpu->x = line->address >> 8;
+    cpu->p &= ~(MCS6502_STATUS_N | MCS6502_STATUS_Z | MCS6502_STATUS_C);
+    if (low == line_index.count) {
+        cpu->a = 0;
+        cpu->y = 1;
+        cpu->p |= MCS6502_STATUS_Z;
+    } else {
+        const bool high_byte = (line->number >> 8) != (linnum >> 8);
+        const uint8_t number = high_byte ? line->number >> 8 : line->number;
+        cpu->a = high_byte ? linnum >> 8 : linnum;
+        cpu->y = high_byte ? 3 : 2;
+        const uint8_t difference = cpu->a - number;
+        cpu->p |= (difference & 0x80 ? MCS6502_STATUS_N : 0) | (difference ? 0 : MCS6502_STATUS_Z) |
+                  (cpu->a >= number ? MCS6502_STATUS_C : 0);
+    }
+    const uint8_t return_low = memory[0x100 + ++cpu->sp];
+    const uint8_t return_high = memory[0x100 + ++cpu->sp];
+    cpu->pc = (uint16_t)((return_low | return_high << 8) + 1);
+    cpu->timingForLastOperation += APPLESOFT_FNDLIN_CYCLES;
+    return true;
+}
+
+#ifdef APPLESOFT_CHECK_FNDLIN
+/**
+ * Looks up random line numbers natively and on the ROM in random programs, changing the
+ * lines between lookups now and then, and reports any difference in memory, registers or
+ * flags to stderr. Returns the number of differences.
+ */
+static int applesoft_check_fndlin(const uint8_t* memory) {
+    static uint8_t rom_memory[0x10000], native_memory[0x10000];
+    static uint16_t starts[0x1000];
+    MCS6502ExecutionContext cpu, native;
+    MCS6502Init(&native, check_read, check_write, NULL);
+    int failures = 0;
+    srand(6502);
+    for (int program = 0; program < 100; program++) {
+        memcpy(native_memory, memory, sizeof(native_memory));
+        for (int address = 0; address < 0x200; address++) {
+            native_memory[address] = rand();
+        }
+        // Lines from TXTTAB up, numbered upwards, mostly in steps of ten
+        const uint16_t txttab = 0x0801 + rand() % 0x100;
+        uint16_t address = txttab;
+        unsigned int number = rand() % 100;
+        int lines = 0;
+        for (int count = rand() % 3000; lines < count && address < 0x9000 && number < 0x10000; lines++) {
+            const uint16_t next = address + 5 + rand() % (rand() % 4 ? 30 : 240);
+            starts[lines] = address;
+            native_memory[address] = next;
+            native_memory[address + 1] = next >> 8;
+            native_memory[address + 2] = number;
+            native_memory[address + 3] = number >> 8;
+            for (int i = address + 4; i < next; i++) {
+                native_memory[i] = rand() % 16 ? 1 + rand() % 255 : 0;
+            }
+            number += rand() % 4 ? 10 : rand() % (rand() % 2 ? 3 : 3000);
+            address = next;
+        }
+        starts[lines] = address;
+        native_memory[address] = rand();
+        native_memory[address + 1] = 0;
+        native_memory[AS_TXTTAB] = txttab;
+        native_memory[AS_TXTTAB + 1] = txttab >> 8;
+        MCS6502InvalidatePages(&native, 0x00, 0x100);
+
+        for (int lookup = 0; lookup < 200; lookup++) {
+            // Now and then write over a line, its link or its number
+            const uint16_t line = starts[rand() % (lines + 1)];
+            switch (rand() % 16) {
+                case 0: native_memory[line + 4 + rand() % 4] = rand(); break;
+                case 1: native_memory[line + 2] = native_memory[line + 2]; break;
+                case 2: if (rand() % 16 == 0) native_memory[line + rand() % 4] = rand(); break;
+                default: break;
+            }
+            MCS6502InvalidatePages(&native, line >> 8, 2);
+            memcpy(rom_memory, native_memory, sizeof(rom_memory));
+
+            // Call FNDLIN, or FL1 with a line (or not quite) in A/X, from a JSR at $0300
+            const uint16_t start = rand() % 8 ? starts[rand() % (lines + 1)] + (rand() % 16 == 0) : txttab;
+            const uint16_t target = rand() % 16 ? (rand() % 2 ? as_word(native_memory, start + 2) : number * (rand() % 1000) / 900)
+                                                : rand();
+            rom_memory[AS_LINNUM] = native_memory[AS_LINNUM] = target;
+            rom_memory[AS_LINNUM + 1] = native_memory[AS_LINNUM + 1] = target >> 8;
+            rom_memory[0x1F0] = native_memory[0x1F0] = 0x03;
+            rom_memory[0x1EF] = native_memory[0x1EF] = 0x02;
+            MCS6502Init(&cpu, check_read, check_write, NULL);
+            cpu.sp = 0xEE;
+            cpu.pc = rand() % 4 ? APPLESOFT_FNDLIN_FROM : APPLESOFT_FNDLIN;
+            cpu.a = start;
+            cpu.x = start >> 8;
+            cpu.y = rand();
+            cpu.p = 0x20 | (rand() & (MCS6502_STATUS_N | MCS6502_STATUS_Z | MCS6502_STATUS_C | MCS6502_STATUS_V));
+            native.sp = cpu.sp;
+            native.pc = cpu.pc;
+            native.a = cpu.a;
+            native.x = cpu.x;
+            native.y = cpu.y;
+            native.p = cpu.p;
+
+            check_memory = rom_memory;
+            for (int steps = 0; cpu.pc != 0x0303 && steps < 1000000; steps++) {
+                MCS6502ExecNext(&cpu);
+            }
+            check_memory = native_memory;
+            applesoft_fndlin_trap(&native, INT_MAX, native_memory);
+            for (int steps = 0; native.pc != 0x0303 && steps < 1000000; steps++) {
+                MCS6502ExecNext(&native);
+            }
+            if (cpu.pc != native.pc || cpu.a != native.a || cpu.x != native.x || cpu.y != native.y ||
+                cpu.sp != native.sp || cpu.p != native.p || memcmp(rom_memory, native_memory, sizeof(rom_memory)) != 0) {
+                if (failures++ < 10) {
+                    fprintf(stderr, "FNDLIN check: $%04X from $%04X for %u: ROM PC=%04X A=%02X X=%02X Y=%02X P=%02X "
+                                    "LOWTR=%04X, native PC=%04X A=%02X X=%02X Y=%02X P=%02X LOWTR=%04X\n",
+                            cpu.pc == native.pc ? APPLESOFT_FNDLIN : 0, start, target, cpu.pc, cpu.a, cpu.x, cpu.y,
+                            cpu.p, as_word(rom_memory, AS_LOWTR), native.pc, native.a, native.x, native.y, native.p,
+                            as_word(native_memory, AS_LOWTR));
+                }
+                memcpy(native_memory, rom_memory, sizeof(native_memory));
+            }
+        }
+    }
+    return failures;
+}
+#endif
+
+/**
+ * Traps FNDLIN if the given memory, which the CPU runs from, holds FP_BASIC_ROM's.
+ */
+bool applesoft_install_line_index(MCS6502ExecutionContext* context, uint8_t* memory) {
+    if (memcmp(&memory[APPLESOFT_FNDLIN], &FP_BASIC_ROM[APPLESOFT_FNDLIN - 0xD000], 0xD649 - APPLESOFT_FNDLIN) != 0) {
+        return false;
+    }
+    line_index.built = false;
+    return MCS6502SetTrap(context, APPLESOFT_FNDLIN, applesoft_fndlin_trap, memory) &&
+           MCS6502SetTrap(context, APPLESOFT_FNDLIN_FROM, applesoft_fndlin_trap, memory);
+}
+
+//
+// Variables. A simple variable is two name bytes and five of value, seven bytes in all,
+// and PTRGET scans them from VARTAB in steps of seven. An array is two name bytes, the
+// offset to the next array, and its dimensions and elements, and the array scan follows
+// the offsets from ARYTAB. Both stop at the first entry with the name in VARNAM.
+//
+
+#define AS_VARNAM 0x81
+
+#define NAME_INDEX_BUCKETS 4096
+#define NAME_INDEX_MAX_ENTRIES (0xC000 / 7)
+typedef struct {
+    bool built;
+    bool linked; // Arrays, found by their offsets; else seven-byte variables
+    uint16_t start, end; // VARTAB to ARYTAB or ARYTAB to STREND, as indexed
+    int count;
+    uint16_t addresses[NAME_INDEX_MAX_ENTRIES]; // Of the entries, in scan order
+    uint16_t names[NAME_INDEX_MAX_ENTRIES];
+    int next[NAME_INDEX_MAX_ENTRIES]; // Later entry in the same bucket, or -1
+    int heads[NAME_INDEX_BUCKETS], tails[NAME_INDEX_BUCKETS];
+    unsigned int generations[256]; // Of the pages from start to end when last checked
+} name_index;
+
+static name_index variable_index = {.linked = false};
+static name_index array_index = {.linked = true};
+
+static inline int name_index_bucket(const uint16_t name) {
+    return (uint16_t)(name * 40503u) >> 4; // Fibonacci hashing to 12 bits
+}
+
+static void name_index_reset(name_index* index, const uint16_t start) {
+    index->built = true;
+    index->start = index->end = start;
+    index->count = 0;
+    memset(index->heads, 0xFF, sizeof(index->heads));
+}
+
+// Returns the first entry with the name, which is the one the ROM finds, or -1
+static int name_index_find(const name_index* index, const uint16_t name) {
+    for (int entry = index->heads[name_index_bucket(name)]; entry >= 0; entry = index->next[entry]) {
+        if (index->names[entry] == name) {
+            return entry;
+        }
+    }
+    return -1;
+}
+
+/**
+ * Indexes the entries from the end of the index up to end. Returns false if they don't
+ * lead there, or the index is full.
+ */
+static bool name_index_extend(name_index* index, const MCS6502ExecutionContext* cpu, const uint8_t* memory,
+                              const uint16_t end) {
+    const uint16_t old_end = index->end;
+    for (uint16_t address = index->end; address != end;) {
+        const uint16_t next = index->linked ? address + as_word(memory, address + 2) : address + 7;
+        if (next <= address || next > end || index->count == NAME_INDEX_MAX_ENTRIES) {
+            return false;
+        }
+        const int entry = index->count++;
+        const uint16_t name = as_word(memory, address);
+        const int bucket = name_index_bucket(name);
+        index->addresses[entry] = address;
+        index->names[entry] = name;
+        index->next[entry] = -1;
+        if (index->heads[bucket] < 0) {
+            index->heads[bucket] = entry;
+        } else {
+            index->next[index->tails[bucket]] = entry;
+        }
+        index->tails[bucket] = entry;
+        address = next;
+    }
+    index->end = end;
+    if (end != old_end) { // The pages up to old_end have just been checked
+        for (int page = old_end >> 8; page <= (end - 1) >> 8; page++) {
+            index->generations[page] = cpu->pageWriteGenerations[page];
+        }
+    }
+    return true;
+}
+
+/**
+ * Returns whether the entries on pages written since they were last checked still have
+ * the names (and for arrays, offsets) they were indexed with. Writes to the values leave
+ * the index alone.
+ */
+static bool name_index_pages_current(name_index* index, const MCS6502ExecutionContext* cpu, const uint8_t* memory) {
+    if (index->count == 0) {
+        return true;
+    }
+    const int header = index->linked ? 4 : 2;
+    for (int page = index->start >> 8; page <= (index->end - 1) >> 8; page++) {
+        if (cpu->pageWriteGenerations[page] == index->generations[page]) {
+            continue;
+        }
+        int low = 0, high = index->count;
+        while (low < high) {
+            const int middle = (low + high) / 2;
+            if (index->addresses[middle] + header <= page * 0x100) {
+                low = middle + 1;
+            } else {
+                high = middle;
+            }
+        }
+        for (int entry = low; entry < index->count && index->addresses[entry] <= page * 0x100 + 0xFF; entry++) {
+            const uint16_t address = index->addresses[entry];
+            const uint16_t next = entry + 1 < index->count ? index->addresses[entry + 1] : index->end;
+            if (as_word(memory, address) != index->names[entry] ||
+                (index->linked && (uint16_t)(address + as_word(memory, address + 2)) != next)) {
+                return false;
+            }
+        }
+        index->generations[page] = cpu->pageWriteGenerations[page];
+    }
+    return true;
+}
+
+/**
+ * Brings the index up to date with the table from start to end, adding entries created
+ * at the end since and rebuilding it if anything else changed. Returns false, leaving
+ * the lookup to the ROM, if the table can't be indexed.
+ */
+static bool name_index_update(name_index* index, const MCS6502ExecutionContext* cpu, const uint8_t* memory,
+                              const uint16_t start, const uint16_t end) {
+    if (start > end || end > 0xC000 || (!index->linked && (end - start) % 7 != 0)) {
+        return false;
+    }
+    if (!index->built || index->start != start || end < index->end || !name_index_pages_current(index, cpu, memory)) {
+        name_index_reset(index, start);
+    }
+    if (!name_index_extend(index, cpu, memory, end)) {
+        index->built = false;
+        return false;
+    }
+    return true;
+}
+
+/**
+ * Finishes the simple variable scan from $E053: at $E0DE with the variable's address in
+ * $9B if it was found, else at $E087, which makes a new one at ARYTAB. The registers and
+ * flags are the scan's, with V from its last step of seven.
+ */
+static bool applesoft_variable_trap(MCS6502ExecutionContext* cpu, int cycle_budget, void* data) {
+    uint8_t* memory = data;
+    if ((cpu->p & MCS6502_STATUS_D) ||
+        !name_index_update(&variable_index, cpu, memory, as_word(memory, AS_VARTAB), as_word(memory, AS_ARYTAB))) {
+        return false;
+    }
+    const int entry = name_index_find(&variable_index, as_word(memory, AS_VARNAM));
+    const uint16_t address = entry >= 0 ? variable_index.addresses[entry] : variable_index.end;
+    if (address != variable_index.start) {
+        const uint8_t before = address - 7, after = address;
+        cpu->p &= ~MCS6502_STATUS_V;
+        cpu->p |= ~(before ^ 7) & (before ^ after) & 0x80 ? MCS6502_STATUS_V : 0;
+    }
+    memory[AS_LOWTR] = address;
+    memory[AS_LOWTR + 1] = address >> 8;
+    MCS6502InvalidatePages(cpu, 0x00, 1);
+    cpu->a = entry >= 0 ? memory[AS_VARNAM + 1] : address;
+    cpu->x = address >> 8;
+    cpu->y = entry >= 0 ? 1 : 0;
+    cpu->p &= ~MCS6502_STATUS_N;
+    cpu->p |= MCS6502_STATUS_Z | MCS6502_STATUS_C;
+    cpu->pc = entry >= 0 ? 0xE0DE : 0xE087;
+    cpu->timingForLastOperation += APPLESOFT_FIND_CYCLES;
+    return true;
+}
+
+/**
+ * Finishes the array scan from $E169: at $E19E if the array was found, else at $E1B8,
+ * which makes a new one at STREND, with $9B, the registers and flags as the scan leaves
+ * them and V from its last addition of an offset.
+ */
+static bool applesoft_array_trap(MCS6502ExecutionContext* cpu, int cycle_budget, void* data) {
+    uint8_t* memory = data;
+    if ((cpu->p & MCS6502_STATUS_D) ||
+        !name_index_update(&array_index, cpu, memory, as_word(memory, AS_ARYTAB), as_word(memory, AS_STREND))) {
+        return false;
+    }
+    const int entry = name_index_find(&array_index, as_word(memory, AS_VARNAM));
+    const int last = entry >= 0 ? entry : array_index.count;
+    const uint16_t address = entry >= 0 ? array_index.addresses[entry] : array_index.end;
+    if (last > 0) {
+        const uint16_t previous = array_index.addresses[last - 1];
+        const uint16_t offset = as_word(memory, previous + 2);
+        const uint8_t high = offset >> 8, sum = address >> 8;
+        cpu->p &= ~MCS6502_STATUS_V;
+        cpu->p |= ~(high ^ (previous >> 8)) & (high ^ sum) & 0x80 ? MCS6502_STATUS_V : 0;
+        cpu->y = 3;
+    }
+    memory[AS_LOWTR] = address;
+    memory[AS_LOWTR + 1] = address >> 8;
+    MCS6502InvalidatePages(cpu, 0x00, 1);
+    if (entry >= 0) {
+        cpu->a = memory[AS_VARNAM + 1];
+        cpu->y = 1;
+    } else {
+        cpu->a = address >> 8;
+    }
+    cpu->x = address;
+    cpu->p &= ~MCS6502_STATUS_N;
+    cpu->p |= MCS6502_STATUS_Z | MCS6502_STATUS_C;
+    cpu->pc = entry >= 0 ? 0xE19E : 0xE1B8;
+    cpu->timingForLastOperation += APPLESOFT_FIND_CYCLES;
+    return true;
+}
+
+#ifdef APPLESOFT_CHECK_PTRGET
+// Makes a table of count variables and a few arrays at VARTAB, with names from a small set
+static void check_ptrget_tables(uint8_t* memory, const uint16_t vartab, const int count) {
+    uint16_t address = vartab;
+    for (int i = 0; i < count; i++, address += 7) {
+        memory[address] = 'A' + rand() % 26;
+        memory[address + 1] = rand() % 4 ? '0' + rand() % 10 : 0;
+        memory[address] |= rand() % 4 == 0 ? 0x80 : 0;
+        memory[address + 1] |= rand() % 4 == 0 ? 0x80 : 0;
+    }
+    memory[AS_ARYTAB] = address;
+    memory[AS_ARYTAB + 1] = address >> 8;
+    for (int arrays = rand() % 8; arrays > 0; arrays--) {
+        const uint16_t size = 7 + rand() % 300;
+        memory[address] = 'A' + rand() % 4;
+        memory[address + 1] = rand() % 2 ? 0x80 : 0;
+        memory[address + 2] = size;
+        memory[address + 3] = size >> 8;
+        address += size;
+    }
+    memory[AS_STREND] = address;
+    memory[AS_STREND + 1] = address >> 8;
+}
+
+/**
+ * Looks up random names natively and on the ROM in random variable and array tables,
+ * writing to them and adding variables and arrays between lookups, and reports any
+ * difference in memory, registers or flags where the ROM's scan ends to stderr. Returns
+ * the number of differences.
+ */
+static int applesoft_check_ptrget(const uint8_t* memory) {
+    static uint8_t rom_memory[0x10000], native_memory[0x10000];
+    MCS6502ExecutionContext cpu, native;
+    MCS6502Init(&native, check_read, check_write, NULL);
+    int failures = 0;
+    srand(6502);
+    for (int tables = 0; tables < 30; tables++) {
+        memcpy(native_memory, memory, sizeof(native_memory));
+        for (int address = 0; address < 0x200; address++) {
+            native_memory[address] = rand();
+        }
+        const uint16_t vartab = 0x0801 + rand() % 0x800;
+        native_memory[AS_VARTAB] = vartab;
+        native_memory[AS_VARTAB + 1] = vartab >> 8;
+        check_ptrget_tables(native_memory, vartab, rand() % 600);
+        MCS6502InvalidatePages(&native, 0x00, 0x100);
+
+        for (int lookup = 0; lookup < 300; lookup++) {
+            const uint16_t arytab = as_word(native_memory, AS_ARYTAB);
+            const uint16_t strend = as_word(native_memory, AS_STREND);
+            switch (rand() % 16) {
+                case 0: { // A value, or rarely a name
+                    const uint16_t address = vartab + rand() % (strend - vartab + 1);
+                    native_memory[address] = rand() % 16 ? native_memory[address] ^ 1 : rand();
+                    MCS6502InvalidatePages(&native, address >> 8, 1);
+                    break;
+                }
+                case 1: // A new variable, moving the arrays up
+                    memmove(&native_memory[arytab + 7], &native_memory[arytab], strend - arytab);
+                    native_memory[arytab] = 'A' + rand() % 26;
+                    native_memory[arytab + 1] = rand() % 2 ? 'Z' : 0;
+                    native_memory[AS_ARYTAB] = arytab + 7;
+                    native_memory[AS_ARYTAB + 1] = (arytab + 7) >> 8;
+                    native_memory[AS_STREND] = strend + 7;
+                    native_memory[AS_STREND + 1] = (strend + 7) >> 8;
+                    MCS6502InvalidatePages(&native, arytab >> 8, ((strend + 7) >> 8) - (arytab >> 8) + 1);
+                    break;
+                case 2: // A new array
+                    native_memory[strend] = 'A' + rand() % 8;
+                    native_memory[strend + 1] = 0x80;
+                    native_memory[strend + 2] = 20;
+                    native_memory[strend + 3] = 0;
+                    native_memory[AS_STREND] = strend + 20;
+                    native_memory[AS_STREND + 1] = (strend + 20) >> 8;
+                    MCS6502InvalidatePages(&native, strend >> 8, 1);
+                    break;
+                default: break;
+            }
+            const bool arrays = rand() % 2;
+            const uint16_t from = as_word(native_memory, arrays ? AS_ARYTAB : AS_VARTAB);
+            const uint16_t to = as_word(native_memory, arrays ? AS_STREND : AS_ARYTAB);
+            if (from != to && rand() % 4) { // Mostly names that are there
+                const uint16_t entry = arrays ? from : from + 7 * (rand() % ((to - from) / 7));
+                native_memory[AS_VARNAM] = native_memory[entry];
+                native_memory[AS_VARNAM + 1] = native_memory[entry + 1];
+            } else {
+                native_memory[AS_VARNAM] = 'A' + rand() % 26;
+                native_memory[AS_VARNAM + 1] = rand() % 2 ? '0' + rand() % 10 : 0;
+            }
+            memcpy(rom_memory, native_memory, sizeof(rom_memory));
+
+            // Run the scan and compare where it ends
+            MCS6502Init(&cpu, check_read, check_write, NULL);
+            cpu.sp = 0xF0;
+            cpu.pc = arrays ? APPLESOFT_FIND_ARRAY : APPLESOFT_FIND_VARIABLE;
+            cpu.a = rand();
+            cpu.x = rand();
+            cpu.y = rand();
+            cpu.p = 0x20 | (rand() & (MCS6502_STATUS_N | MCS6502_STATUS_Z | MCS6502_STATUS_C | MCS6502_STATUS_V));
+            native.sp = cpu.sp;
+            native.pc = cpu.pc;
+            native.a = cpu.a;
+            native.x = cpu.x;
+            native.y = cpu.y;
+            native.p = cpu.p;
+            const uint16_t found = arrays ? 0xE19E : 0xE0DE;
+            const uint16_t not_found = arrays ? 0xE1B8 : 0xE087;
+
+            check_memory = rom_memory;
+            for (int steps = 0; cpu.pc != found && cpu.pc != not_found && steps < 1000000; steps++) {
+                MCS6502ExecNext(&cpu);
+            }
+            check_memory = native_memory;
+            if (!(arrays ? applesoft_array_trap : applesoft_variable_trap)(&native, INT_MAX, native_memory)) {
+                for (int steps = 0; native.pc != found && native.pc != not_found && steps < 1000000; steps++) {
+                    MCS6502ExecNext(&native);
+                }
+            }
+            if (cpu.pc != native.pc || cpu.a != native.a || cpu.x != native.x || cpu.y != native.y ||
+                cpu.p != native.p || memcmp(rom_memory, native_memory, sizeof(rom_memory)) != 0) {
+                if (failures++ < 10) {
+                    fprintf(stderr, "PTRGET check: %s %02X%02X: ROM PC=%04X A=%02X X=%02X Y=%02X P=%02X $9B=%04X, "
+                                    "native PC=%04X A=%02X X=%02X Y=%02X P=%02X $9B=%04X\n",
+                            arrays ? "array" : "variable", native_memory[AS_VARNAM], native_memory[AS_VARNAM + 1],
+                            cpu.pc, cpu.a, cpu.x, cpu.y, cpu.p, as_word(rom_memory, AS_LOWTR), native.pc, native.a,
+                            native.x, native.y, native.p, as_word(native_memory, AS_LOWTR));
+                }
+                memcpy(native_memory, rom_memory, sizeof(native_memory));
+            }
+        }
+    }
+    return failures;
+}
+#endif
+
+/**
+ * Traps PTRGET's variable and array scans if the given memory, which the CPU runs from,
+ * holds FP_BASIC_ROM's.
+ */
+bool applesoft_install_variable_index(MCS6502ExecutionContext* context, uint8_t* memory) {
+    if (memcmp(&memory[0xDFE3], &FP_BASIC_ROM[0xDFE3 - 0xD000], 0xE1B8 - 0xDFE3) != 0) {
+        return false;
+    }
+    variable_index.built = array_index.built = false;
+    return MCS6502SetTrap(context, APPLESOFT_FIND_VARIABLE, applesoft_variable_trap, memory) &&
+           MCS6502SetTrap(context, APPLESOFT_FIND_ARRAY, applesoft_array_trap, memory);
+}
+
+//
+// Programs. Keywords are in a table at $D0D0, each with the high bit set on its last
+// character and the whole table ended by a 0; token $80 is the first. PARSE crunches the
+// line in the input buffer in place, after LINGET has read its number, and line entry
+// puts it in the program with its link and number in front.
+//
+
+#define AS_DATPTR 0x7D
+#define AS_FRETOP 0x6F
+#define AS_PRGEND 0xAF
+#define AS_LOCK 0xD6
+#define AS_KEYWORDS 0xD0D0
+#define AS_TOKEN_DATA 0x83
+#define AS_TOKEN_REM 0xB2
+#define AS_TOKEN_PRINT 0xBA
+#define AS_TOKEN_AT 0xC5
+
+// Tokenized lines, kept by line number until the program is laid out
+#define PROGRAM_MAX_BYTES 0x10000
+static struct {
+    int32_t lines[64000]; // Offset in bytes of each line's tokens, or -1
+    uint8_t bytes[PROGRAM_MAX_BYTES];
+} program;
+
+/**
+ * Matches a keyword at input[*in] as PARSE does, skipping spaces inside it. Returns its
+ * token with *in at its last character, or 0 if no keyword is there.
+ */
+static uint8_t program_match_keyword(const uint8_t* memory, const uint8_t* input, int* in) {
+    uint16_t keyword = AS_KEYWORDS;
+    for (uint8_t token = 0x80; memory[keyword] != 0; token++) {
+        int x = *in;
+        uint16_t y = keyword;
+        for (;;) {
+            while (input[x] == ' ') {
+                x++;
+            }
+            const uint8_t difference = input[x] - memory[y];
+            if (difference == 0x80 && // The last character, unless AT is really ATN or the start of TO
+                !(token == AS_TOKEN_AT && (input[x + 1] == 'N' || input[x + 1] == 'O'))) {
+                *in = x;
+                return token;
+            }
+            if (difference != 0) {
+                break;
+            }
+            x++;
+            y++;
+        }
+        while (!(memory[keyword++] & 0x80)) { // On to the next keyword
+        }
+    }
+    return 0;
+}
+
+/**
+ * PARSE ($D559): tokenizes the 0-terminated line at input, from just after its line
+ * number, into output. Returns the number of bytes, the 0 at the end included.
+ */
+static int program_parse(const uint8_t* memory, const uint8_t* input, uint8_t* output) {
+    int in = 0, out = 0;
+    bool data = false; // Bit 6 of DATAFLG ($13): after DATA, until a colon
+    for (;;) {
+        uint8_t c = input[in];
+        if (c == ' ' && !data) {
+            in++;
+            continue;
+        }
+        if (c == '"') { // Copied up to the closing quote, or the end of the line
+            output[out++] = c;
+            in++;
+            while (input[in] != 0 && input[in] != '"') {
+                output[out++] = input[in++];
+            }
+            c = input[in];
+        } else if (data || (c >= '0' && c <= ';')) { // Digits, colons and semicolons as they are
+        } else if (c == '?') {
+            c = AS_TOKEN_PRINT;
+        } else {
+            const uint8_t token = program_match_keyword(memory, input, &in);
+            if (token != 0) {
+                c = token;
+            }
+        }
+        in++;
+        output[out++] = c;
+        if (c == 0) {
+            return out;
+        }
+        if (c == ':' || c == AS_TOKEN_DATA) {
+            data = c == AS_TOKEN_DATA;
+        } else if (c == AS_TOKEN_REM) { // The rest of the line as it is
+            while (input[in] != 0) {
+                output[out++] = input[in++];
+            }
+            output[out++] = 0;
+            return out;
+        }
+    }
+}
+
+#ifdef APPLESOFT_CHECK_PARSE
+/**
+ * Tokenizes random lines, made mostly of keywords and the characters PARSE treats
+ * specially, natively and with the ROM's PARSE, and reports any difference in the tokens
+ * to stderr. Returns the number of differences.
+ */
+static int applesoft_check_parse(const uint8_t* memory) {
+    static const char* pieces[] = {" ", "  ", "\"", ":", "?", "DATA", "REM", "AT", "ATN", "AT N", "A T", "N", "O",
+                                   "TO", "TAB(", "HGR2", "FOR", "PRINT", "P R I N T", "GOTO", "1", "23", ";", "<",
+                                   "=", ">", "(", ",", "$", "%", "A", "X", "Q", "Z", "FN", "ON", "STEP", "END"};
+    static uint8_t rom_memory[0x10000];
+    static uint8_t input[APPLESOFT_MAX_LINE + 1], output[APPLESOFT_MAX_LINE + 1];
+    MCS6502ExecutionContext cpu;
+    int failures = 0;
+    srand(6502);
+    for (int line = 0; line < 20000; line++) {
+        int length = 0;
+        for (int target = rand() % (APPLESOFT_MAX_LINE + 1); length < target;) {
+            const char* piece = rand() % 4 ? pieces[rand() % (sizeof(pieces) / sizeof(pieces[0]))] : NULL;
+            if (piece == NULL) { // Or any printable character
+                input[length++] = 0x20 + rand() % 0x5F;
+                continue;
+            }
+            for (; *piece != '\0' && length < target; piece++) {
+                input[length++] = *piece;
+            }
+        }
+        input[length] = 0;
+        const int native_length = program_parse(memory, input, output);
+
+        memcpy(rom_memory, memory, sizeof(rom_memory));
+        memcpy(&rom_memory[0x200], input, length + 1);
+        rom_memory[0xB8] = 0x00; // TXTPTR at the start of the input buffer
+        rom_memory[0xB9] = 0x02;
+        rom_memory[AS_LOCK] = 0;
+        rom_memory[0x1FF] = 0x03; // Return to $0303
+        rom_memory[0x1FE] = 0x02;
+        check_memory = rom_memory;
+        MCS6502Init(&cpu, check_read, check_write, NULL);
+        cpu.sp = 0xFD;
+        cpu.pc = 0xD559;
+        for (int steps = 0; cpu.pc != 0x0303 && steps < 1000000; steps++) {
+            MCS6502ExecNext(&cpu);
+        }
+        if (cpu.y != native_length + 4 || memcmp(&rom_memory[0x200], output, native_length) != 0) {
+            if (failures++ < 10) {
+                fprintf(stderr, "PARSE check: \"%s\" is %d bytes on the ROM, %d natively\n", input, cpu.y - 4,
+                        native_length);
+            }
+        }
+    }
+    return failures;
+}
+#endif
+
+/**
+ * Whether the given memory holds FP_BASIC_ROM's keywords, which the program functions
+ * use, and the Applesoft ROM they follow.
+ */
+static bool program_rom_known(const uint8_t* memory) {
+    if (memcmp(&memory[0xD0D0], &FP_BASIC_ROM[0xD0D0 - 0xD000], 0xD260 - 0xD0D0) != 0 ||
+        memcmp(&memory[0xD539], &FP_BASIC_ROM[0xD539 - 0xD000], 0xD766 - 0xD539) != 0) {
+        return false;
+    }
+    return true;
+}
+
+/**
+ * Reads the line number at the start of input as LINGET ($DA0C) does, skipping spaces,
+ * and leaves *in after it. Returns -1 if the line doesn't start with a digit or the
+ * number is 64000 or more, which Applesoft takes as a SYNTAX ERROR.
+ */
+static int program_line_number(const uint8_t* input, int* in) {
+    int x = 0;
+    while (input[x] == ' ') {
+        x++;
+    }
+    if (input[x] < '0' || input[x] > '9') {
+        return -1;
+    }
+    int number = 0;
+    for (; input[x] >= '0' && input[x] <= '9'; x++) {
+        if (number >= 6400) {
+            return -1;
+        }
+        number = number * 10 + input[x] - '0';
+        while (input[x + 1] == ' ') {
+            x++;
+        }
+    }
+    *in = x;
+    return number;
+}
+
+/**
+ * Replaces the Applesoft program in memory with the listing in text, as if NEW had been
+ * typed and then each of its lines: lines go in order of number, a later line replaces
+ * one with the same number, and a number on its own deletes the line. Variables are
+ * cleared. Lines end with a CR, LF or both; blank ones are skipped. Reports the first
+ * line that isn't a program line, one too long to type, or a program too big for memory
+ * below HIMEM to stderr, and returns false leaving memory as it was.
+ */
+bool applesoft_load_program(MCS6502ExecutionContext* context, uint8_t* memory, const char* text, size_t length) {
+    static uint8_t input[APPLESOFT_MAX_LINE + 1];
+    if (!program_rom_known(memory)) {
+        fprintf(stderr, "Unknown Applesoft ROM, can't load a program\n");
+        return false;
+    }
+    for (int number = 0; number < 64000; number++) {
+        program.lines[number] = -1;
+    }
+    int used = 0;
+    int line = 1;
+    for (size_t i = 0; i < length; line++) {
+        // Take the line as it would be typed
+        int x = 0;
+        bool too_long = false;
+        for (; i < length && text[i] != '\n' && text[i] != '\r'; i++) {
+            uint8_t c = text[i] & 0x7F;
+            c = c == '\t' ? ' ' : c >= 'a' && c <= 'z' ? c - 'a' + 'A' : c;
+            if (c >= ' ' && c != 0x7F) {
+                if (x < APPLESOFT_MAX_LINE) {
+                    input[x++] = c;
+                } else {
+                    too_long = true;
+                }
+            }
+        }
+        input[x] = 0;
+        if (too_long) {
+            fprintf(stderr, "Line %d of the program is longer than %d characters: %s\n", line, APPLESOFT_MAX_LINE,
+                    input);
+            return false;
+        }
+        i += i + 1 < length && text[i] == '\r' && text[i + 1] == '\n' ? 2 : 1;
+        if (strspn((const char*)input, " ") == (size_t)x) {
+            continue;
+        }
+
+        int in;
+        const int number = program_line_number(input, &in);
+        if (number < 0) {
+            fprintf(stderr, "Line %d of the program has no line number below 64000: %s\n", line, input);
+            return false;
+        }
+        if (used + APPLESOFT_MAX_LINE + 1 > PROGRAM_MAX_BYTES) {
+            fprintf(stderr, "Program too big, stopped at line %d\n", line);
+            return false;
+        }
+        const int tokens = program_parse(memory, &input[in], &program.bytes[used]);
+        program.lines[number] = tokens > 1 ? used : -1;
+        used += tokens;
+    }
+
+    // Lay the lines out from TXTTAB, making sure they fit below HIMEM first
+    const uint16_t txttab = as_word(memory, AS_TXTTAB);
+    const uint16_t memsiz = as_word(memory, AS_MEMSIZ);
+    unsigned int end = txttab;
+    for (int number = 0; number < 64000; number++) {
+        if (program.lines[number] >= 0) {
+            end += 4 + strlen((const char*)&program.bytes[program.lines[number]]) + 1;
+        }
+    }
+    const unsigned int vartab = end + 2;
+    if (vartab >= memsiz) {
+        fprintf(stderr, "Program too big, %u bytes past HIMEM\n", vartab - memsiz);
+        return false;
+    }
+    unsigned int address = txttab;
+    for (int number = 0; number < 64000; number++) {
+        if (program.lines[number] < 0) {
+            continue;
+        }
+        const uint8_t* tokens = &program.bytes[program.lines[number]];
+        const size_t size = strlen((const char*)tokens) + 1;
+        const unsigned int next = address + 4 + size;
+        memory[address] = next;
+        memory[address + 1] = next >> 8;
+        memory[address + 2] = number;
+        memory[address + 3] = number >> 8;
+        memcpy(&memory[address + 4], tokens, size);
+        address = next;
+    }
+    memory[end] = memory[end + 1] = 0;
+
+    // What NEW and CLEAR leave
+    memory[AS_VARTAB] = memory[AS_ARYTAB] = memory[AS_STREND] = memory[AS_PRGEND] = vartab;
+    memory[AS_VARTAB + 1] = memory[AS_ARYTAB + 1] = memory[AS_STREND + 1] = memory[AS_PRGEND + 1] = vartab >> 8;
+    memory[AS_FRETOP] = memsiz;
+    memory[AS_FRETOP + 1] = memsiz >> 8;
+    memory[AS_DATPTR] = txttab - 1;
+    memory[AS_DATPTR + 1] = (txttab - 1) >> 8;
+    memory[AS_TEMPPT] = 0x55;
+    memory[0x14] = 0; // SUBFLG
+    memory[0x7A] = 0; // OLDTEXT's high byte, so there is nothing to CONT
+    memory[AS_LOCK] = 0;
+    MCS6502InvalidatePages(context, 0x00, 1);
+    MCS6502InvalidatePages(context, txttab >> 8, (vartab >> 8) - (txttab >> 8) + 1);
+    return true;
+}
+
+/**
+ * Writes the Applesoft program in memory to file as LIST prints it, without its breaks
+ * every 33 columns: each line's number and a space, then its text with every keyword
+ * between spaces. Returns false if the file couldn't be written, or if the program's
+ * links run backwards or into I/O space, after writing the lines before.
+ */
+bool applesoft_save_program(const uint8_t* memory, FILE* file) {
+    if (!program_rom_known(memory)) {
+        fprintf(stderr, "Unknown Applesoft ROM, can't save the program\n");
+        return false;
+    }
+    unsigned int address = as_word(memory, AS_TXTTAB);
+    while (address < 0xC000 && memory[address + 1] != 0) {
+        const unsigned int next = as_word(memory, address);
+        if (next <= address || next >= 0xC000) {
+            fprintf(stderr, "Program link at $%04X is broken\n", address);
+            return false;
+        }
+        fprintf(file, "%u ", as_word(memory, address + 2));
+        for (unsigned int i = address + 4; i < next && memory[i] != 0; i++) {
+            if (memory[i] < 0x80) {
+                fputc(memory[i], file);
+                continue;
+            }
+            uint16_t keyword = AS_KEYWORDS; // Past as many keywords as the token is after $80
+            for (int skip = memory[i] - 0x80; skip > 0; skip--) {
+                while (!(memory[keyword++] & 0x80)) {
+                }
+            }
+            fputc(' ', file);
+            do {
+                fputc(memory[keyword] & 0x7F, file);
+            } while (!(memory[keyword++] & 0x80));
+            fputc(' ', file);
+        }
+        fputc('\n', file);
+        address = next;
+    }
+    return !ferror(file);
+}
@@ -0,0 +1,87 @@
+#pragma once
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include "MCS6502.h"
+
+// Applesoft acceleration
+// Native versions of Applesoft routines, trapped at their ROM entry points (see
+// MCS6502SetTrap). They follow the ROM code instruction for instruction, so memory,
+// registers and flags come out exactly as the 6502 code would leave them, and they are
+// only installed over the FP_BASIC_ROM they were written from. tools/applesoft_check.c
+// runs each of them and the ROM code side by side on random inputs.
+
+// Floating point
+// FADDT, FMULTT and FDIVT do FAC = ARG op FAC on the 5-byte floats in the zero page.
+// FADD, FSUB, FMULT and FDIV load ARG from memory and run into them, and the
+// transcendentals (SIN, LOG, EXP, SQR, ...) are built from them, so all of those get
+// faster too. Each call is charged a fixed number of cycles instead of the ROM's few
+// hundred to several thousand. Measured with tools/fp_bench.c, FMULTT and FDIVT take
+// some 30 times fewer cycles and well over 10 times less host time, FADDT 5 times fewer
+// cycles, but SQR, LOG, EXP and SIN only 6-7 times fewer cycles and about 5 times less
+// host time, as the rest of their 6502 code still runs.
+#define APPLESOFT_FADDT 0xE7C1
+#define APPLESOFT_FMULTT 0xE982
+#define APPLESOFT_FDIVT 0xEA69
+#define APPLESOFT_FADD_CYCLES 40
+#define APPLESOFT_FMULT_CYCLES 60
+#define APPLESOFT_FDIV_CYCLES 80
+
+typedef struct {
+    uint8_t* mem; // 64K the routine works on
+    uint8_t a, x, y, sp;
+    bool n, z, c, v;
+    uint8_t p; // For the bits PHP pushes besides N, Z, C and V
+    uint16_t pc; // Where the last RTS went
+    bool error; // Left for the ROM's ERROR ($D412), with the code in X
+} applesoft_fp_state;
+
+bool applesoft_install_fast_fp(MCS6502ExecutionContext* context, uint8_t* memory);
+
+// String space
+// GARBAG ($E484), which FRE and running out of string space call, moves the strings in
+// use to the top of memory one at a time, each found by a scan of every string
+// descriptor: quadratic in the number of strings. The native version sorts the
+// descriptors once and does the same moves in the same order, then lets the ROM do its
+// last, empty scan so the zero page scratch comes out as the ROM leaves it.
+#define APPLESOFT_GARBAG 0xE484
+#define APPLESOFT_GARBAG_CYCLES_PER_STRING 100
+
+bool applesoft_install_fast_garbag(MCS6502ExecutionContext* context, uint8_t* memory);
+
+// Line numbers
+// FNDLIN ($D61A, or $D61E from the line at A/X) finds the first line numbered LINNUM or
+// more by following the program's links, for every GOTO and GOSUB among others. The
+// native version looks the line up in an index of the program, built on first use and
+// rebuilt when writes to the program area (see MCS6502InvalidatePages) change a line's
+// link or number.
+#define APPLESOFT_FNDLIN 0xD61A
+#define APPLESOFT_FNDLIN_FROM 0xD61E
+#define APPLESOFT_FNDLIN_CYCLES 60
+
+bool applesoft_install_line_index(MCS6502ExecutionContext* context, uint8_t* memory);
+
+// Variables
+// PTRGET looks a variable up by scanning the simple variables (VARTAB to ARYTAB) from the
+// start, at $E053, and arrays the same way through ARYTAB to STREND, at $E169. The native
+// versions find the name in a hash index of each table and continue where the ROM's scan
+// would stop: at the variable or array found, or where it creates a new one, which is
+// then added to the index. The indexes follow writes to the tables like the line index.
+#define APPLESOFT_FIND_VARIABLE 0xE053
+#define APPLESOFT_FIND_ARRAY 0xE169
+#define APPLESOFT_FIND_CYCLES 40
+
+bool applesoft_install_variable_index(MCS6502ExecutionContext* context, uint8_t* memory);
+
+// Programs
+// A program is tokenized the way PARSE ($D559) does a typed line, keywords matched with
+// the ROM's table, and laid out at TXTTAB with the pointers NEW, line entry and CLEAR
+// leave, so a listing of any size loads at once instead of being typed in. The program
+// in memory is written back out the way LIST prints it. Lines are taken as the Apple II
+// keyboard would send them: in capitals, at most 239 characters (INLIN's limit).
+#define APPLESOFT_RESTART 0xD43C // Where Applesoft prints its prompt for a new line
+#define APPLESOFT_MAX_LINE 239
+
+bool applesoft_load_program(MCS6502ExecutionContext* context, uint8_t* memory, const char* text, size_t length);
+bool applesoft_save_program(const uint8_t* memory, FILE* file);
@@ -2,8 +2,15 @@
 
 #include "crapple.h"
 #include "MCS6502.c"
+#include "applesoft.c"
+#ifdef USE_TRANSLATED_ROMS
+#include "translated_roms.h" // Generated by the translate_roms target (tools/rom2c.c)
+#endif
 #include <SDL2/SDL.h>
 #include <errno.h>
+#if defined(__SSE2__)
+#include <immintrin.h>
+#endif
 
 int crapple_init() {
     if (SDL_Init(SDL_INIT_VIDEO) < 0) {
@@ -51,6 +58,9 @@ int crapple_init() {
 
     // Load character ROM
     crapple_load_char_rom();
+    crapple_build_text_glyphs(TEXT_FOREGROUND, TEXT_BACKGROUND);
+    crapple_build_lores_lines();
+    crapple_build_hires_lines();
 
     // Init audio
     crapple_init_audio();
@@ -60,7 +70,60 @@ int crapple_init() {
     paste_active = false;
     paste_index = 0;
 
-    MCS6502Init(&context, readBytesFn, writeBytesFn, NULL);
+    // The bus functions get the CPU context back so they can end a run early.
+    MCS6502Init(&context, readBytesFn, writeBytesFn, &context);
+    crapple_map_memory();
+    if (!MCS6502EnableBlockCache(&context)) {
+        fprintf(stderr, "Block cache unavailable, interpreting every instruction\n");
+    }
+#ifdef USE_TRANSLATED_ROMS
+    if (!translated_roms_install(&context)) {
+        fprintf(stderr, "No translated code for this ROM, interpreting it\n");
+    }
+#endif
+    crapple_install_wait_skip();
+#ifdef USE_HLE
+    crapple_install_hle();
+#endif
+#ifdef USE_FAST_FP
+    if (!applesoft_install_fast_fp(&context, MEMORY)) {
+        fprintf(stderr, "Unknown Applesoft ROM, not accelerating floating point\n");
+    }
+#endif
+#ifdef USE_FAST_GARBAG
+    if (!applesoft_install_fast_garbag(&context, MEMORY)) {
+        fprintf(stderr, "Unknown Applesoft ROM, not accelerating garbage collection\n");
+    }
+#endif
+#ifdef USE_LINE_INDEX
+    if (!applesoft_install_line_index(&context, MEMORY)) {
+        fprintf(stderr, "Unknown Applesoft ROM, not indexing line numbers\n");
+    }
+#endif
+#ifdef USE_VARIABLE_INDEX
+    if (!applesoft_install_variable_index(&context, MEMORY)) {
+        fprintf(stderr, "Unknown Applesoft ROM, not indexing variables\n");
+    }
+#endif
+    if (program_at_start) {
+        crapple_install_program_load();
+    }
+#ifdef USE_BASIC_PROFILER
+    crapple_install_basic_profiler();
+#endif
+#ifdef USE_COUNTERS
+    if (!MCS6502EnableCounters(&context)) {
+        fprintf(stderr, "Counters unavailable, not counting instructions\n");
+    }
+#endif
+#ifdef USE_CALL_GRAPH
+    if (MCS6502EnableCallGraph(&context)) {
+        crapple_load_call_symbols();
+    }
+    else {
+        fprintf(stderr, "Call graph unavailable, not following calls\n");
+    }
+#endif
     MCS6502Reset(&context);
     // MCS6502Tick(&context);
 
@@ -71,6 +134,19 @@ int crapple_init() {
     return 0;
 }
 
+/**
+ * Sets up the CPU page table.  RAM ($0000-$BFFF) is read and written directly,
+ * only the soft switch page ($C0xx) goes through readBytesFn/writeBytesFn, and
+ * the card and BASIC/Monitor ROM space ($C100-$FFFF) is read directly and
+ * write-protected.
+ */
+void crapple_map_memory() {
+    MCS6502MapReadPages(&context, 0x00, 0xC0, &MEMORY[0x0000]);
+    MCS6502MapWritePages(&context, 0x00, 0xC0, &MEMORY[0x0000]);
+    MCS6502MapReadPages(&context, 0xC1, 0x3F, &MEMORY[0xC100]);
+    MCS6502WriteProtectPages(&context, 0xC1, 0x3F);
+}
+
 int crapple_init_audio() {
     // Audio setup
     SDL_zero(audio_spec);
@@ -128,6 +204,7 @@ void crapple_update() {
     uint64_t cycles_last = total_cycles;
 
     static bool reset_triggered = false;
+    bool window_stale = true; // Has to be presented again even if the frame is the same
 
     while (crapple_running) {
         SDL_Event event;
@@ -135,6 +212,9 @@ void crapple_update() {
             if (event.type == SDL_QUIT) {
                 crapple_running = false;
             }
+            else if (event.type == SDL_WINDOWEVENT) {
+                window_stale = true; // Exposed, resized, restored...
+            }
             else if (event.type == SDL_KEYDOWN) {
                 SDL_Keycode key = event.key.keysym.sym;
                 Uint16 mod = event.key.keysym.mod; // Get modifier state
@@ -163,6 +243,57 @@ void crapple_update() {
                     continue;
                 }
 
+                // Hotkeys for programs: F5 loads program_path, F6 saves to it
+                if (key == SDLK_F5) {
+                    if (MEMORY[0x76] != 0xFF) { // CURLIN is $FFxx only in direct mode
+                        printf("Applesoft is running a program, not loading %s\n", program_path);
+                    }
+                    else {
+                        crapple_load_program(program_path);
+                    }
+                    continue;
+                }
+                if (key == SDLK_F6) {
+                    if (program_load_failed) {
+                        printf("%s didn't load, not saving over it (fix it and press F5)\n", program_path);
+                    }
+                    else {
+                        crapple_save_program(program_path);
+                    }
+                    continue;
+                }
+#ifdef USE_BASIC_PROFILER
+                if (key == SDLK_F7) {
+                    crapple_write_profile(PROFILE_PATH);
+                    continue;
+                }
+#endif
+#ifdef USE_COUNTERS
+                if (key == SDLK_F8) {
+                    if (mod & KMOD_SHIFT) {
+                        if (context.counters) {
+                            memset(context.counters, 0, sizeof(MCS6502Counters));
+                        }
+                    }
+                    else {
+                        crapple_write_counters(COUNTERS_PATH);
+                    }
+                    continue;
+                }
+#endif
+#ifdef USE_CALL_GRAPH
+                if (key == SDLK_F9) {
+                    if (mod & KMOD_SHIFT) {
+                        MCS6502DisableCallGraph(&context);
+                        MCS6502EnableCallGraph(&context);
+                    }
+                    else {
+                        crapple_write_call_graph(CALLS_PATH);
+                    }
+                    continue;
+                }
+#endif
+
                 // Process keys only after reset
                 // if (!reset_triggered) continue;
 
@@ -386,17 +517,43 @@ void crapple_update() {
         double elapsed_sec = elapsed_ms / 1000.0;
         uint32_t cycles_to_run = (uint32_t)(target_cycles_per_sec * elapsed_sec);
 
-        // Run CPU update, also handles timing for audio.
-        for (int i = 0; i < cycles_per_frame; i++) {
-            MCS6502Tick(&context);
-            total_cycles++; // increment total cycles
-            cycle_count++;
+        // Run CPU update, also handles timing for audio. The CPU runs in batches up to the
+        // next scheduled event or the end of the frame, and batches end early whenever a
+        // soft switch is hit, so the toggle cycle stays exact. Whatever the last
+        // instruction runs past the frame is taken off the next one.
+        frame_end_cycle += cycles_per_frame;
+        while (total_cycles < frame_end_cycle) {
+            // Anything already due (e.g. posted from an SDL event handler) fires first, so
+            // the next deadline is always ahead and a batch that runs nothing is stuck.
+            crapple_run_due_events();
+            uint64_t deadline = crapple_next_event_cycle();
+            if (deadline > frame_end_cycle) {
+                deadline = frame_end_cycle;
+            }
+            const int budget = (int)(deadline - total_cycles);
+            const int cycles_run = budget - MCS6502Run(&context, budget);
+            total_cycles += cycles_run; // increment total cycles
+            cycle_count += cycles_run;
 
             if (speaker_toggle) {
                 speaker_toggle = false;
                 last_toggle_cycle = cycle_count;
                 toggle_duration = SAMPLE_RATE / 20; // ~50 ms
             }
+
+            if (keyin_polling) {
+                keyin_polling = false;
+                const int skipped = crapple_skip_keyin((int)(deadline - total_cycles));
+                total_cycles += skipped;
+                cycle_count += skipped;
+            }
+
+            crapple_run_due_events();
+
+            if (cycles_run == 0) {
+                frame_end_cycle = total_cycles; // Stuck on an invalid opcode
+                break;
+            }
         }
 
         // Update MHz every 60 frames (~1 sec)
@@ -415,24 +572,32 @@ void crapple_update() {
             frame_counter = 0;
         }
 
-        if (graphics_mode) {
-            crapple_render_lores_page();
+        // Only upload and present frames that changed (or that the window lost)
+        bool frame_changed;
+        if (graphics_mode && hires_mode) {
+            frame_changed = crapple_render_hires_page();
+        }
+        else if (graphics_mode) {
+            frame_changed = crapple_render_lores_page();
         }
         else {
-            crapple_render_text_page();
+            frame_changed = crapple_render_text_page();
         }
 
-        // Render text page 1
-        // crapple_render_text_page_1();
-
         // Flash cursor
         flash_on = (cursor_timer / 16) % 2 == 0;
         cursor_timer--;
+        dirty_frame++;
 
-        SDL_UpdateTexture(texture, NULL, pixels, WIDTH * sizeof(uint32_t));
-        SDL_RenderClear(renderer);
-        SDL_RenderCopy(renderer, texture, NULL, NULL);
-        SDL_RenderPresent(renderer);
+        if (frame_changed) {
+            SDL_UpdateTexture(texture, NULL, pixels, WIDTH * sizeof(uint32_t));
+        }
+        if (frame_changed || window_stale) {
+            SDL_RenderClear(renderer);
+            SDL_RenderCopy(renderer, texture, NULL, NULL);
+            SDL_RenderPresent(renderer);
+            window_stale = false;
+        }
 
         const Uint32 currentTime = SDL_GetTicks();
         if (currentTime < nextTime) {
@@ -442,7 +607,915 @@ void crapple_update() {
     }
 }
 
+/**
+ * Posts fn(cycle, data) to run once total_cycles reaches cycle.  Returns false if the
+ * queue is full.  Events can post further events, e.g. to repeat.
+ */
+bool crapple_schedule(uint64_t cycle, crapple_event_fn fn, void* data) {
+    if (event_count == MAX_EVENTS) {
+        fprintf(stderr, "Event queue full, dropping event for cycle %llu\n", (unsigned long long)cycle);
+        return false;
+    }
+    crapple_event event = {cycle, event_order++, fn, data};
+
+    // Sift up
+    int i = event_count++;
+    while (i > 0) {
+        int parent = (i - 1) / 2;
+        crapple_event* p = &event_heap[parent];
+        if (p->cycle < event.cycle || (p->cycle == event.cycle && p->order < event.order)) {
+            break;
+        }
+        event_heap[i] = *p;
+        i = parent;
+    }
+    event_heap[i] = event;
+    return true;
+}
+
+/**
+ * The cycle the earliest event is due, or UINT64_MAX with nothing scheduled.
+ */
+uint64_t crapple_next_event_cycle() {
+    return event_count > 0 ? event_heap[0].cycle : UINT64_MAX;
+}
+
+/**
+ * Fires, in order, every event due at or before total_cycles.
+ */
+void crapple_run_due_events() {
+    while (event_count > 0 && event_heap[0].cycle <= total_cycles) {
+        crapple_event due = event_heap[0];
+
+        // Move the last event to the top and sift it down
+        crapple_event last = event_heap[--event_count];
+        int i = 0;
+        while (true) {
+            int child = 2 * i + 1;
+            if (child >= event_count) {
+                break;
+            }
+            crapple_event* c = &event_heap[child];
+            if (child + 1 < event_count) {
+                crapple_event* right = &event_heap[child + 1];
+                if (right->cycle < c->cycle || (right->cycle == c->cycle && right->order < c->order)) {
+                    c = right;
+                    child++;
+                }
+            }
+            if (last.cycle < c->cycle || (last.cycle == c->cycle && last.order < c->order)) {
+                break;
+            }
+            event_heap[i] = *c;
+            i = child;
+        }
+        event_heap[i] = last;
+
+        due.fn(due.cycle, due.data);
+    }
+}
+
+/**
+ * Returns whether any page of the length bytes from start has been written since seen
+ * was last cleared for it.
+ */
+bool crapple_dirty(const crapple_dirty_pages* seen, const uint16_t start, const uint32_t length) {
+    for (uint32_t page = start >> 8; page < 256 && page << 8 < start + length; page++) {
+        if (seen->generations[page] != context.pageWriteGenerations[page]) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * Sets bit page % 64 of bitmap[page / 64] for every page written since seen was last
+ * cleared for it, and clears the rest.  Returns the number of pages written.
+ */
+int crapple_dirty_bitmap(const crapple_dirty_pages* seen, uint64_t bitmap[4]) {
+    int count = 0;
+    memset(bitmap, 0, 4 * sizeof(bitmap[0]));
+    for (int page = 0; page < 256; page++) {
+        if (seen->generations[page] != context.pageWriteGenerations[page]) {
+            bitmap[page / 64] |= 1ULL << (page % 64);
+            count++;
+        }
+    }
+    return count;
+}
+
+/**
+ * Marks the pages of the length bytes from start as seen, as they are now.
+ */
+void crapple_dirty_clear(crapple_dirty_pages* seen, const uint16_t start, const uint32_t length) {
+    for (uint32_t page = start >> 8; page < 256 && page << 8 < start + length; page++) {
+        seen->generations[page] = context.pageWriteGenerations[page];
+    }
+}
+
+/**
+ * Runs as many whole trips round KEYIN's wait loop as fit in the given cycles, in O(1),
+ * for a CPU stopped right after the loop's BIT KBD found no key.  Each trip from the
+ * BPL back to there is BPL, INC RNDL, BNE, BIT: 15 cycles, or 19 when RNDL wraps and
+ * INC RNDH runs too.  Registers and flags come out as they went in, only RNDH:RNDL
+ * counts the trips.  Returns the cycles skipped; the CPU runs any remainder itself.
+ */
+int crapple_skip_keyin(int cycles) {
+    if (context.pc != KEYIN_POLL + 3 || memcmp(&MEMORY[KEYIN_LOOP], keyin_code, sizeof(keyin_code)) != 0) {
+        return 0;
+    }
+    const uint16_t rnd = MEMORY[RNDL] | MEMORY[RNDL + 1] << 8;
+    int trips = cycles / 15;
+    while (trips > 0 && 15 * trips + 4 * (((rnd & 0xFF) + trips) >> 8) > cycles) {
+        trips--;
+    }
+    if (trips == 0) {
+        return 0;
+    }
+    const uint16_t seed = rnd + trips;
+    MEMORY[RNDL] = seed & 0xFF;
+    MEMORY[RNDL + 1] = seed >> 8;
+    MCS6502InvalidatePages(&context, RNDL >> 8, 1);
+    return 15 * trips + 4 * (((rnd & 0xFF) + trips) >> 8);
+}
+
+// The HLE routines below mirror the 6502 code they replace instruction by instruction,
+// flags included, on a crapple_hle_state, with the loops over screen memory done as
+// block moves.
+
+static void hle_nz(crapple_hle_state* s, const uint8_t value) {
+    s->n = value & 0x80;
+    s->z = value == 0;
+}
+
+static void hle_adc(crapple_hle_state* s, const uint8_t value) {
+    const unsigned int sum = s->a + value + s->c;
+    s->v = ~(s->a ^ value) & (s->a ^ sum) & 0x80;
+    s->c = sum > 0xFF;
+    s->a = sum;
+    hle_nz(s, s->a);
+}
+
+static void hle_compare(crapple_hle_state* s, const uint8_t reg, const uint8_t value) {
+    s->c = reg >= value;
+    hle_nz(s, reg - value);
+}
+
+static void hle_touch(crapple_hle_state* s, const uint16_t address, const int length) {
+    if (address >> 8 < s->dirty_low) { s->dirty_low = address >> 8; }
+    if ((address + length - 1) >> 8 > s->dirty_high) { s->dirty_high = (address + length - 1) >> 8; }
+}
+
+// (zp),Y
+static uint16_t hle_indirect(const uint8_t zp, const uint8_t y) {
+    return (uint16_t)((MEMORY[zp] | MEMORY[zp + 1] << 8) + y);
+}
+
+static uint8_t hle_read(const uint16_t address) {
+    return address < 0xC000 ? MEMORY[address] : readBytesFn(address, &context);
+}
+
+static void hle_write(crapple_hle_state* s, const uint16_t address, const uint8_t value) {
+    if (address >= 0xC000) {
+        writeBytesFn(address, value, &context);
+        return;
+    }
+    MEMORY[address] = value;
+    hle_touch(s, address, 1);
+}
+
+// BASCALC ($FBC1): BASH:BASL for the text line in A
+static void hle_bascalc(crapple_hle_state* s) {
+    const uint8_t line = s->a;
+    MEMORY[ZP_BASL + 1] = ((line >> 1) & 0x03) | 0x04;
+    s->c = line & 0x01;
+    s->a = line & 0x18;
+    if (s->c) {
+        hle_adc(s, 0x7F);
+    }
+    MEMORY[ZP_BASL] = s->a;
+    s->c = s->a & 0x40;
+    s->a = (uint8_t)(s->a << 2) | MEMORY[ZP_BASL];
+    MEMORY[ZP_BASL] = s->a;
+    hle_nz(s, s->a);
+}
+
+// VTABZ ($FC24): base address for the line in A, offset by the window's left edge
+static void hle_vtabz(crapple_hle_state* s) {
+    hle_bascalc(s);
+    hle_adc(s, MEMORY[ZP_WNDLFT]);
+    MEMORY[ZP_BASL] = s->a;
+}
+
+// VTAB ($FC22)
+static void hle_vtab(crapple_hle_state* s) {
+    s->a = MEMORY[ZP_CV];
+    hle_nz(s, s->a);
+    hle_vtabz(s);
+}
+
+// CLEOLZ ($FC9E): blank (BASL),Y up to the window's width
+static void hle_cleolz(crapple_hle_state* s) {
+    const uint8_t width = MEMORY[ZP_WNDWDTH];
+    const uint16_t address = hle_indirect(ZP_BASL, s->y);
+    s->a = 0xA0;
+    if (s->y < width && address + (width - s->y) <= 0xC000) {
+        memset(&MEMORY[address], s->a, width - s->y);
+        hle_touch(s, address, width - s->y);
+        s->y = width;
+        hle_compare(s, s->y, width);
+        return;
+    }
+    do {
+        hle_write(s, hle_indirect(ZP_BASL, s->y), s->a);
+        s->y++;
+        hle_compare(s, s->y, width);
+    } while (!s->c);
+}
+
+// SCROLL ($FC70): move the window up a line and blank the bottom one
+static void hle_scroll(crapple_hle_state* s) {
+    s->a = MEMORY[ZP_WNDTOP];
+    hle_nz(s, s->a);
+    uint8_t line = s->a; // PHA
+    hle_vtabz(s);
+    for (;;) {
+        MEMORY[ZP_BAS2L] = MEMORY[ZP_BASL];
+        MEMORY[ZP_BAS2L + 1] = MEMORY[ZP_BASL + 1];
+        s->y = MEMORY[ZP_WNDWDTH] - 1;
+        s->a = line; // PLA
+        hle_adc(s, 0x01);
+        hle_compare(s, s->a, MEMORY[ZP_WNDBTM]);
+        if (s->c) {
+            break;
+        }
+        line = s->a;
+        hle_vtabz(s);
+
+        // Copy bytes Y down to 0 from the new line to the one above
+        const uint16_t from = hle_indirect(ZP_BASL, 0);
+        const uint16_t to = hle_indirect(ZP_BAS2L, 0);
+        const int length = s->y + 1;
+        if (s->y < 0x80 && from + length <= 0xC000 && to + length <= 0xC000 &&
+            (from >= to + length || to >= from + length)) {
+            memcpy(&MEMORY[to], &MEMORY[from], length);
+            hle_touch(s, to, length);
+            s->a = MEMORY[from];
+            s->y = 0xFF;
+        } else {
+            do {
+                s->a = hle_read(hle_indirect(ZP_BASL, s->y));
+                hle_write(s, hle_indirect(ZP_BAS2L, s->y), s->a);
+                s->y--;
+            } while (!(s->y & 0x80));
+        }
+        hle_nz(s, s->y);
+    }
+    s->y = 0;
+    hle_nz(s, s->y);
+    hle_cleolz(s);
+    hle_vtab(s);
+}
+
+// LF ($FC66): next line, scrolling at the bottom of the window
+static void hle_lf(crapple_hle_state* s) {
+    MEMORY[ZP_CV]++;
+    s->a = MEMORY[ZP_CV];
+    hle_compare(s, s->a, MEMORY[ZP_WNDBTM]);
+    if (!s->c) {
+        hle_vtabz(s);
+        return;
+    }
+    MEMORY[ZP_CV]--;
+    hle_nz(s, MEMORY[ZP_CV]);
+    hle_scroll(s);
+    s->cycles += HLE_SCROLL_CYCLES;
+}
+
+// CR ($FC62)
+static void hle_cr(crapple_hle_state* s) {
+    s->a = 0;
+    hle_nz(s, s->a);
+    MEMORY[ZP_CH] = 0;
+    hle_lf(s);
+}
+
+// STORADV ($FBF0): store A at the cursor and advance it
+static void hle_storadv(crapple_hle_state* s) {
+    s->y = MEMORY[ZP_CH];
+    hle_write(s, hle_indirect(ZP_BASL, s->y), s->a);
+    MEMORY[ZP_CH]++;
+    s->a = MEMORY[ZP_CH];
+    hle_compare(s, s->a, MEMORY[ZP_WNDWDTH]);
+    if (s->c) {
+        hle_cr(s);
+    }
+}
+
+// UP ($FC1A)
+static void hle_up(crapple_hle_state* s) {
+    s->a = MEMORY[ZP_WNDTOP];
+    hle_compare(s, s->a, MEMORY[ZP_CV]);
+    if (s->c) {
+        return;
+    }
+    MEMORY[ZP_CV]--;
+    hle_vtab(s);
+}
+
+// BS ($FC10): back a column, wrapping to the end of the line above
+static void hle_bs(crapple_hle_state* s) {
+    MEMORY[ZP_CH]--;
+    hle_nz(s, MEMORY[ZP_CH]);
+    if (!s->n) {
+        return;
+    }
+    s->a = MEMORY[ZP_WNDWDTH];
+    MEMORY[ZP_CH] = s->a - 1;
+    hle_nz(s, MEMORY[ZP_CH]);
+    hle_up(s);
+}
+
+// VIDOUT ($FBFD), less the bell, which COUT1's trap leaves to the ROM
+static void hle_vidout(crapple_hle_state* s) {
+    hle_compare(s, s->a, 0xA0);
+    if (!s->c) {
+        s->y = s->a;
+        hle_nz(s, s->y);
+        if (s->n) {
+            hle_compare(s, s->a, 0x8D);
+            if (s->z) { hle_cr(s); return; }
+            hle_compare(s, s->a, 0x8A);
+            if (s->z) { hle_lf(s); return; }
+            hle_compare(s, s->a, 0x88);
+            if (s->z) { hle_bs(s); return; }
+            hle_compare(s, s->a, 0x87);
+            return;
+        }
+    }
+    hle_storadv(s);
+}
+
+/**
+ * Loads the registers for a trapped routine. Returns false, leaving the call to the ROM,
+ * in decimal mode, where the routines' ADCs would behave differently.
+ */
+static bool hle_begin(const MCS6502ExecutionContext* cpu, crapple_hle_state* s, const int cycles) {
+    if (cpu->p & MCS6502_STATUS_D) {
+        return false;
+    }
+    *s = (crapple_hle_state){
+        .a = cpu->a, .y = cpu->y,
+        .n = cpu->p & MCS6502_STATUS_N, .z = cpu->p & MCS6502_STATUS_Z,
+        .c = cpu->p & MCS6502_STATUS_C, .v = cpu->p & MCS6502_STATUS_V,
+        .cycles = cycles,
+        .dirty_low = 0, .dirty_high = 0, // The zero page always
+    };
+    return true;
+}
+
+static void hle_rts(MCS6502ExecutionContext* cpu) {
+    const uint8_t low = MEMORY[0x100 + ++cpu->sp];
+    const uint8_t high = MEMORY[0x100 + ++cpu->sp];
+    cpu->pc = (uint16_t)((low | high << 8) + 1);
+}
+
+// Stores the registers back and returns from the routine (RTS)
+static void hle_finish(MCS6502ExecutionContext* cpu, const crapple_hle_state* s) {
+    cpu->a = s->a;
+    cpu->y = s->y;
+    cpu->p &= ~(MCS6502_STATUS_N | MCS6502_STATUS_Z | MCS6502_STATUS_C | MCS6502_STATUS_V);
+    cpu->p |= (s->n ? MCS6502_STATUS_N : 0) | (s->z ? MCS6502_STATUS_Z : 0) |
+              (s->c ? MCS6502_STATUS_C : 0) | (s->v ? MCS6502_STATUS_V : 0);
+    hle_rts(cpu);
+    cpu->timingForLastOperation += s->cycles;
+    MCS6502InvalidatePages(cpu, s->dirty_low, s->dirty_high - s->dirty_low + 1);
+}
+
+// COUT1 ($FDF0): output A to the screen, keeping A and Y
+static bool crapple_hle_cout(MCS6502ExecutionContext* cpu, int cycle_budget, void* data) {
+    crapple_hle_state s;
+    if (!hle_begin(cpu, &s, HLE_COUT_CYCLES)) {
+        return false;
+    }
+    hle_compare(&s, s.a, 0xA0);
+    if (s.c) {
+        s.a &= MEMORY[ZP_INVFLG];
+        hle_nz(&s, s.a);
+    }
+    // The bell and a Ctrl-S pause at the end of a line are left to the ROM
+    if (s.a == 0x87 || (s.a == 0x8D && (readBytesFn(0xC000, &context) == 0x93))) {
+        return false;
+    }
+    MEMORY[ZP_YSAV1] = s.y;
+    const uint8_t character = s.a; // PHA
+    hle_vidout(&s);
+    s.a = character;
+    s.y = MEMORY[ZP_YSAV1];
+    hle_nz(&s, s.y);
+    hle_finish(cpu, &s);
+    return true;
+}
+
+// SCROLL ($FC70)
+static bool crapple_hle_scroll(MCS6502ExecutionContext* cpu, int cycle_budget, void* data) {
+    crapple_hle_state s;
+    if (!hle_begin(cpu, &s, HLE_SCROLL_CYCLES)) {
+        return false;
+    }
+    hle_scroll(&s);
+    hle_finish(cpu, &s);
+    return true;
+}
+
+// HOME ($FC58): blank the window and put the cursor at its top left
+static bool crapple_hle_home(MCS6502ExecutionContext* cpu, int cycle_budget, void* data) {
+    crapple_hle_state s;
+    if (!hle_begin(cpu, &s, HLE_HOME_CYCLES)) {
+        return false;
+    }
+    s.a = MEMORY[ZP_WNDTOP];
+    MEMORY[ZP_CV] = s.a;
+    s.y = 0;
+    MEMORY[ZP_CH] = 0;
+    do {
+        const uint8_t line = s.a; // PHA
+        hle_vtabz(&s);
+        hle_cleolz(&s);
+        s.y = 0;
+        s.a = line;
+        hle_adc(&s, 0x00);
+        hle_compare(&s, s.a, MEMORY[ZP_WNDBTM]);
+    } while (!s.c);
+    hle_vtab(&s);
+    hle_finish(cpu, &s);
+    return true;
+}
+
+// CLREOL ($FC9C): blank from the cursor to the end of the line
+static bool crapple_hle_clreol(MCS6502ExecutionContext* cpu, int cycle_budget, void* data) {
+    crapple_hle_state s;
+    if (!hle_begin(cpu, &s, HLE_CLREOL_CYCLES)) {
+        return false;
+    }
+    s.y = MEMORY[ZP_CH];
+    hle_cleolz(&s);
+    hle_finish(cpu, &s);
+    return true;
+}
+
+/**
+ * Traps COUT1, SCROLL, HOME and CLREOL if the Monitor's video routines are the ones in
+ * the built-in ROMs. The stack below SP isn't written the way the ROM code would leave it.
+ */
+void crapple_install_hle() {
+    // The Monitor is the same in both images
+    if (memcmp(&MEMORY[0xFB78], &FP_BASIC_ROM[0xFB78 - 0xD000], 0xFCA8 - 0xFB78) != 0 ||
+        memcmp(&MEMORY[0xFDF0], &FP_BASIC_ROM[0xFDF0 - 0xD000], 0xFE00 - 0xFDF0) != 0) {
+        fprintf(stderr, "Unknown Monitor ROM, not using HLE\n");
+        return;
+    }
+    MCS6502SetTrap(&context, 0xFDF0, crapple_hle_cout, NULL);
+    MCS6502SetTrap(&context, 0xFC70, crapple_hle_scroll, NULL);
+    MCS6502SetTrap(&context, 0xFC58, crapple_hle_home, NULL);
+    MCS6502SetTrap(&context, 0xFC9C, crapple_hle_clreol, NULL);
+}
+
+/**
+ * Runs the rest of a WAIT, or as many passes of its outer loop as fit in the budget. A
+ * pass with A = k is PHA, k trips round SBC #1 / BNE, PLA, SBC #1, BNE: 5k + 11 cycles,
+ * one less for the last, which the RTS follows. Left to the ROM in decimal mode, for
+ * A = 0 (which wraps round with the carry clear) and when not even one pass fits.
+ */
+static bool crapple_wait(MCS6502ExecutionContext* cpu, int cycle_budget, void* data) {
+    const bool entry = cpu->pc == WAIT; // Else WAIT_LOOP, where the carry must be set
+    if ((cpu->p & MCS6502_STATUS_D) || cpu->a == 0 || (!entry && !(cpu->p & MCS6502_STATUS_C))) {
+        return false;
+    }
+    int cycles = entry ? 2 : 0; // SEC
+    int k = cpu->a;
+    const int rest = 5 * k * (k + 1) / 2 + 11 * k - 1 + 6;
+    if (cycles + rest > cycle_budget) {
+        while (k > 1 && cycles + 5 * k + 11 <= cycle_budget) {
+            cycles += 5 * k + 11;
+            k--;
+        }
+        if (k == cpu->a) {
+            return false;
+        }
+    } else {
+        cycles += rest;
+        k = 0;
+    }
+
+    // As the last SBC #1 leaves them
+    MEMORY[0x100 + cpu->sp] = k + 1; // Left by the last PHA
+    cpu->a = k;
+    cpu->p &= ~(MCS6502_STATUS_N | MCS6502_STATUS_Z | MCS6502_STATUS_V);
+    cpu->p |= MCS6502_STATUS_C | (k & 0x80 ? MCS6502_STATUS_N : 0) | (k == 0 ? MCS6502_STATUS_Z : 0) |
+              (k == 0x7F ? MCS6502_STATUS_V : 0);
+    if (k == 0) {
+        hle_rts(cpu);
+    } else {
+        cpu->pc = WAIT_LOOP;
+    }
+    MCS6502InvalidatePages(cpu, 0x01, 1);
+    cpu->timingForLastOperation += cycles;
+    return true;
+}
+
+/**
+ * Traps WAIT if it is the one in the built-in ROMs. The cycles and registers are exact,
+ * so this is always on.
+ */
+void crapple_install_wait_skip() {
+    if (memcmp(&MEMORY[WAIT], wait_code, sizeof(wait_code)) != 0) {
+        return;
+    }
+    MCS6502SetTrap(&context, WAIT, crapple_wait, NULL);
+    MCS6502SetTrap(&context, WAIT_LOOP, crapple_wait, NULL);
+}
+
+#ifdef USE_BASIC_PROFILER
+/**
+ * Counts a run of the line NEWSTT has just put in CURLIN, and lets the ROM carry on.
+ */
+static bool crapple_profile_newline(MCS6502ExecutionContext* cpu, int cycle_budget, void* data) {
+    profile.line_hits[MEMORY[0x75] | MEMORY[0x76] << 8]++;
+    profile.in_program = true;
+    return false;
+}
+
+/**
+ * Gives the cycles since the last sample to the line in CURLIN and to the part of memory
+ * the PC is in, if a program is running, and posts the next sample.
+ */
+static void crapple_profile_sample(uint64_t cycle, void* data) {
+    const uint64_t cycles = total_cycles - profile.last_cycle;
+    profile.last_cycle = total_cycles;
+    profile.total += cycles;
+    if (MEMORY[0x76] == PROFILE_DIRECT) {
+        profile.in_program = false;
+    }
+    if (profile.in_program) {
+        profile.running += cycles;
+        profile.line_cycles[MEMORY[0x75] | MEMORY[0x76] << 8] += cycles;
+        size_t area = 0;
+        while (context.pc < profile_areas[area].first || context.pc > profile_areas[area].last) {
+            area++;
+        }
+        profile.area_cycles[area] += cycles;
+    }
+    crapple_schedule(total_cycles + PROFILE_SAMPLE_CYCLES, crapple_profile_sample, NULL);
+}
+
+/**
+ * Starts sampling and counting lines if NEWSTT is the one in FP_BASIC_ROM.
+ */
+void crapple_install_basic_profiler() {
+    if (memcmp(&MEMORY[0xD7D2], &FP_BASIC_ROM[0xD7D2 - 0xD000], 0xD826 - 0xD7D2) != 0) {
+        fprintf(stderr, "Unknown Applesoft ROM, not profiling\n");
+        return;
+    }
+    profile.last_cycle = total_cycles;
+    MCS6502SetTrap(&context, PROFILE_NEWLINE, crapple_profile_newline, NULL);
+    crapple_schedule(total_cycles + PROFILE_SAMPLE_CYCLES, crapple_profile_sample, NULL);
+}
+
+// Most cycles first, then by line number
+static int profile_compare_lines(const void* a, const void* b) {
+    const uint16_t line_a = *(const uint16_t*)a, line_b = *(const uint16_t*)b;
+    if (profile.line_cycles[line_a] != profile.line_cycles[line_b]) {
+        return profile.line_cycles[line_a] < profile.line_cycles[line_b] ? 1 : -1;
+    }
+    return line_a - line_b;
+}
+
+int crapple_write_profile(const char* path) {
+    // Report the cycles and runs of each line that ran, then the cycles in each part of memory
+    FILE* file = fopen(path, "w");
+    if (!file) {
+        fprintf(stderr, "Profile file %s open failed: %s\n", path, strerror(errno));
+        return 1;
+    }
+    const double running = profile.running > 0 ? profile.running : 1;
+    fprintf(file, "%llu cycles sampled every %d, %llu of them running a program\n\n",
+            (unsigned long long)profile.total, PROFILE_SAMPLE_CYCLES, (unsigned long long)profile.running);
+
+    static uint16_t lines[0x10000];
+    int count = 0;
+    for (int line = 0; line < 0x10000; line++) {
+        if (profile.line_cycles[line] > 0 || profile.line_hits[line] > 0) {
+            lines[count++] = line;
+        }
+    }
+    qsort(lines, count, sizeof(lines[0]), profile_compare_lines);
+    fprintf(file, " line        cycles        %%        runs\n");
+    for (int i = 0; i < count; i++) {
+        fprintf(file, "%5u  %12llu  %6.2f%%  %10u\n", lines[i], (unsigned long long)profile.line_cycles[lines[i]],
+                100.0 * profile.line_cycles[lines[i]] / running, profile.line_hits[lines[i]]);
+    }
+
+    fprintf(file, "\n%-40s  %12s  %7s\n", "PC in", "cycles", "%");
+    for (size_t area = 0; area < PROFILE_AREAS; area++) {
+        bool listed = false; // Areas with the same name are listed together, under the first
+        uint64_t cycles = 0;
+        for (size_t other = 0; other < PROFILE_AREAS; other++) {
+            if (strcmp(profile_areas[other].name, profile_areas[area].name) == 0) {
+                listed |= other < area;
+                cycles += profile.area_cycles[other];
+            }
+        }
+        if (!listed) {
+            fprintf(file, "%-40s  %12llu  %6.2f%%\n", profile_areas[area].name, (unsigned long long)cycles,
+                    100.0 * cycles / running);
+        }
+    }
+
+    if (fclose(file) != 0) {
+        fprintf(stderr, "Profile file %s write failed\n", path);
+        return 1;
+    }
+    printf("Wrote %s\n", path);
+    return 0;
+}
+#endif
+
+#ifdef USE_COUNTERS
+// Opens path with suffix added for writing, reporting a failure
+static FILE* counters_open(const char* path, const char* suffix, char* name, const size_t size) {
+    snprintf(name, size, "%s%s", path, suffix);
+    FILE* file = fopen(name, "w");
+    if (!file) {
+        fprintf(stderr, "Counters file %s open failed: %s\n", name, strerror(errno));
+    }
+    return file;
+}
+
+// Closes a file written by crapple_write_counters, reporting a failure
+static int counters_close(FILE* file, const char* name) {
+    if (fclose(file) != 0) {
+        fprintf(stderr, "Counters file %s write failed\n", name);
+        return 1;
+    }
+    printf("Wrote %s\n", name);
+    return 0;
+}
+
+int crapple_write_counters(const char* path) {
+    // Write the opcode and address counts as CSV, and them and the ROM coverage as JSON
+    const MCS6502Counters* counters = context.counters;
+    char name[1024];
+    if (!counters) {
+        return 1;
+    }
+
+    FILE* file = counters_open(path, "_opcodes.csv", name, sizeof(name));
+    if (!file) {
+        return 1;
+    }
+    fprintf(file, "opcode,mnemonic,executions,cycles,page_crossings\n");
+    for (int opcode = 0; opcode < 256; opcode++) {
+        if (counters->opcodeExecutions[opcode] > 0) {
+            fprintf(file, "%02X,%s,%llu,%llu,%llu\n", opcode, MCS6502OpcodeMnemonic(opcode),
+                    counters->opcodeExecutions[opcode], counters->opcodeCycles[opcode],
+                    counters->opcodePageCrossings[opcode]);
+        }
+    }
+    if (counters_close(file, name) != 0) {
+        return 1;
+    }
+
+    // The opcode is the one in memory now, which code in RAM may have changed since
+    file = counters_open(path, "_addresses.csv", name, sizeof(name));
+    if (!file) {
+        return 1;
+    }
+    fprintf(file, "address,opcode,mnemonic,executions,cycles\n");
+    for (int address = 0; address < 0x10000; address++) {
+        if (counters->pcExecutions[address] > 0) {
+            fprintf(file, "%04X,%02X,%s,%llu,%llu\n", address, MEMORY[address], MCS6502OpcodeMnemonic(MEMORY[address]),
+                    counters->pcExecutions[address], counters->pcCycles[address]);
+        }
+    }
+    if (counters_close(file, name) != 0) {
+        return 1;
+    }
+
+    file = counters_open(path, ".json", name, sizeof(name));
+    if (!file) {
+        return 1;
+    }
+    fprintf(file, "{\n  \"opcodes\": [");
+    const char* separator = "\n";
+    for (int opcode = 0; opcode < 256; opcode++) {
+        if (counters->opcodeExecutions[opcode] > 0) {
+            fprintf(file,
+                    "%s    {\"opcode\": \"%02X\", \"mnemonic\": \"%s\", \"executions\": %llu, \"cycles\": %llu, "
+                    "\"page_crossings\": %llu}",
+                    separator, opcode, MCS6502OpcodeMnemonic(opcode), counters->opcodeExecutions[opcode],
+                    counters->opcodeCycles[opcode], counters->opcodePageCrossings[opcode]);
+            separator = ",\n";
+        }
+    }
+    fprintf(file, "\n  ],\n  \"addresses\": [");
+    separator = "\n";
+    for (int address = 0; address < 0x10000; address++) {
+        if (counters->pcExecutions[address] > 0) {
+            fprintf(file, "%s    {\"address\": \"%04X\", \"executions\": %llu, \"cycles\": %llu}", separator,
+                    address, counters->pcExecutions[address], counters->pcCycles[address]);
+            separator = ",\n";
+        }
+    }
+
+    // Every byte of an instruction that ran, as ranges of addresses
+    static bool executed[0x10000 - COUNTERS_ROM_START];
+    memset(executed, 0, sizeof(executed));
+    int executed_bytes = 0;
+    for (int address = COUNTERS_ROM_START; address < 0x10000; address++) {
+        if (counters->pcExecutions[address] > 0) {
+            const int length = MCS6502OpcodeLength(MEMORY[address]);
+            for (int i = address; i < address + length && i < 0x10000; i++) {
+                executed_bytes += !executed[i - COUNTERS_ROM_START];
+                executed[i - COUNTERS_ROM_START] = true;
+            }
+        }
+    }
+    fprintf(file, "\n  ],\n  \"rom_coverage\": {\"first\": \"%04X\", \"last\": \"FFFF\", \"bytes\": %d, "
+                  "\"executed\": %d, \"ranges\": [", COUNTERS_ROM_START, 0x10000 - COUNTERS_ROM_START, executed_bytes);
+    separator = "";
+    for (int address = COUNTERS_ROM_START; address < 0x10000; address++) {
+        if (executed[address - COUNTERS_ROM_START] &&
+            (address == COUNTERS_ROM_START || !executed[address - 1 - COUNTERS_ROM_START])) {
+            int last = address;
+            while (last + 1 < 0x10000 && executed[last + 1 - COUNTERS_ROM_START]) {
+                last++;
+            }
+            fprintf(file, "%s[\"%04X\", \"%04X\"]", separator, address, last);
+            separator = ", ";
+        }
+    }
+    fprintf(file, "]}\n}\n");
+    return counters_close(file, name);
+}
+#endif
+
+#ifdef USE_CALL_GRAPH
+void crapple_load_call_symbols() {
+    // Read the names of routines from the symbol maps there are, later maps first
+    for (size_t i = 0; i < sizeof(call_symbol_maps) / sizeof(call_symbol_maps[0]); i++) {
+        FILE* file = fopen(call_symbol_maps[i], "r");
+        if (!file) {
+            fprintf(stderr, "Symbol map %s open failed: %s\n", call_symbol_maps[i], strerror(errno));
+            continue;
+        }
+        char line[256];
+        while (fgets(line, sizeof(line), file)) {
+            unsigned int address;
+            char name[128];
+            if (sscanf(line, "%x %127s", &address, name) == 2 && address < 0x10000) { // Not a # comment
+                free(call_symbols[address]);
+                call_symbols[address] = strdup(name);
+            }
+        }
+        fclose(file);
+    }
+}
+
+// The name of a node's routine: its symbol, or its address
+static const char* call_node_name(const MCS6502CallGraph* graph, const int node, char* buffer) {
+    if (node == 0) {
+        return "(top level)";
+    }
+    const uint16_t routine = graph->nodes[node].routine;
+    if (call_symbols[routine]) {
+        return call_symbols[routine];
+    }
+    sprintf(buffer, "$%04X", routine);
+    return buffer;
+}
+
+static struct {
+    unsigned long long calls, inclusive, exclusive;
+} call_routines[0x10000];
+
+// Most cycles inclusive first, then by address
+static int call_compare_routines(const void* a, const void* b) {
+    const uint16_t routine_a = *(const uint16_t*)a, routine_b = *(const uint16_t*)b;
+    if (call_routines[routine_a].inclusive != call_routines[routine_b].inclusive) {
+        return call_routines[routine_a].inclusive < call_routines[routine_b].inclusive ? 1 : -1;
+    }
+    return routine_a - routine_b;
+}
+
+int crapple_write_call_graph(const char* path) {
+    // Write the chains of calls in folded form, and the calls and cycles of each routine as CSV
+    const MCS6502CallGraph* graph = context.callGraph;
+    char name[1024], buffer[8];
+    if (!graph) {
+        return 1;
+    }
+    if (graph->lostCalls > 0) {
+        fprintf(stderr, "%llu calls left out of the call graph for lack of room\n", graph->lostCalls);
+    }
+
+    snprintf(name, sizeof(name), "%s.folded", path);
+    FILE* file = fopen(name, "w");
+    if (!file) {
+        fprintf(stderr, "Call graph file %s open failed: %s\n", name, strerror(errno));
+        return 1;
+    }
+    static int chain[MCS6502_CALL_DEPTH + 1];
+    for (int node = 0; node < graph->nodeCount; node++) {
+        if (graph->nodes[node].cycles == 0) {
+            continue;
+        }
+        int depth = 0;
+        for (int caller = node; caller >= 0; caller = graph->nodes[caller].parent) {
+            chain[depth++] = caller;
+        }
+        while (depth-- > 0) {
+            fprintf(file, "%s%s", call_node_name(graph, chain[depth], buffer), depth > 0 ? ";" : "");
+        }
+        fprintf(file, " %llu\n", graph->nodes[node].cycles);
+    }
+    if (fclose(file) != 0) {
+        fprintf(stderr, "Call graph file %s write failed\n", name);
+        return 1;
+    }
+    printf("Wrote %s\n", name);
+
+    // Nodes come after their callers, so each can be added to its caller's in turn. A
+    // routine's inclusive cycles leave out its calls under a call of itself, which are in
+    // the outer one's already.
+    static unsigned long long totals[MCS6502_CALL_NODES];
+    for (int node = 0; node < graph->nodeCount; node++) {
+        totals[node] = graph->nodes[node].cycles;
+    }
+    for (int node = graph->nodeCount - 1; node > 0; node--) {
+        totals[graph->nodes[node].parent] += totals[node];
+    }
+    memset(call_routines, 0, sizeof(call_routines));
+    for (int node = 1; node < graph->nodeCount; node++) {
+        const uint16_t routine = graph->nodes[node].routine;
+        call_routines[routine].calls += graph->nodes[node].calls;
+        call_routines[routine].exclusive += graph->nodes[node].cycles;
+        int caller = graph->nodes[node].parent;
+        while (caller > 0 && graph->nodes[caller].routine != routine) {
+            caller = graph->nodes[caller].parent;
+        }
+        if (caller <= 0) {
+            call_routines[routine].inclusive += totals[node];
+        }
+    }
+    static uint16_t routines[0x10000];
+    int count = 0;
+    for (int routine = 0; routine < 0x10000; routine++) {
+        if (call_routines[routine].calls > 0) {
+            routines[count++] = routine;
+        }
+    }
+    qsort(routines, count, sizeof(routines[0]), call_compare_routines);
+
+    snprintf(name, sizeof(name), "%s.csv", path);
+    file = fopen(name, "w");
+    if (!file) {
+        fprintf(stderr, "Call graph file %s open failed: %s\n", name, strerror(errno));
+        return 1;
+    }
+    const double total = totals[0] > 0 ? totals[0] : 1;
+    fprintf(file, "routine,name,calls,inclusive_cycles,inclusive_percent,exclusive_cycles,exclusive_percent\n");
+    fprintf(file, ",%s,,%llu,100.00,%llu,%.2f\n", call_node_name(graph, 0, buffer), totals[0], graph->nodes[0].cycles,
+            100.0 * graph->nodes[0].cycles / total);
+    for (int i = 0; i < count; i++) {
+        const uint16_t routine = routines[i];
+        fprintf(file, "%04X,%s,%llu,%llu,%.2f,%llu,%.2f\n", routine,
+                call_symbols[routine] ? call_symbols[routine] : "", call_routines[routine].calls,
+                call_routines[routine].inclusive, 100.0 * call_routines[routine].inclusive / total,
+                call_routines[routine].exclusive, 100.0 * call_routines[routine].exclusive / total);
+    }
+    if (fclose(file) != 0) {
+        fprintf(stderr, "Call graph file %s write failed\n", name);
+        return 1;
+    }
+    printf("Wrote %s\n", name);
+    return 0;
+}
+#endif
+
 void crapple_terminate() {
+#ifdef USE_BASIC_PROFILER
+    crapple_write_profile(PROFILE_PATH);
+#endif
+#ifdef USE_COUNTERS
+    crapple_write_counters(COUNTERS_PATH);
+    MCS6502DisableCounters(&context);
+#endif
+#ifdef USE_CALL_GRAPH
+    crapple_write_call_graph(CALLS_PATH);
+    MCS6502DisableCallGraph(&context);
+#endif
+    MCS6502DisableBlockCache(&context);
     SDL_CloseAudio(); // Shut down audio
     SDL_DestroyTexture(texture);
     SDL_DestroyRenderer(renderer);
@@ -474,177 +1547,251 @@ void crapple_terminate() {
         Row 8:  $0428
         ...
  */
-// DEPRECATED
-void crapple_render_text_page_1() {
-    for (int row = 0; row < 24; row++) {
-        for (int col = 0; col < 40; col++) {
-            uint8_t chr = MEMORY[row_start_addresses[row] + col];
-            uint8_t glyph_idx = chr;
-            uint32_t fg_color = 0xFF00FF00; // Green (normal)
-            uint32_t bg_color = 0xFF000000; // Black (background)
-
-            // Handle character modes
-            if (chr >= 0x00 && chr <= 0x3F) {
-                // Inverse
-                glyph_idx = chr | 0x40; // Map to normal glyph
-                fg_color = 0xFF000000; // Black foreground
-                bg_color = 0xFF00FF00; // Green background
-            }
-            else if (chr >= 0x40 && chr <= 0x7F) {
-                // Flashing
-                glyph_idx = chr & 0x3F; // Base glyph
-                if (flash_on) {
-                    fg_color = 0xFF000000; // Black foreground (inverse)
-                    bg_color = 0xFF00FF00; // Green background
-                }
-                else {
-                    fg_color = 0xFF00FF00; // Green foreground (normal)
-                    bg_color = 0xFF000000; // Black background
-                }
+/**
+ * Expands FONT into text_glyphs in the given colors.  Screen codes below $40 are inverse,
+ * those below $80 flash (inverse while flash_on) and the rest are normal.
+ */
+void crapple_build_text_glyphs(const uint32_t foreground, const uint32_t background) {
+    for (int flash = 0; flash < 2; flash++) {
+        for (int code = 0; code < 256; code++) {
+            uint8_t glyph = code & 0x7F;
+            bool inverse = false;
+            if (code <= 0x3F) {
+                glyph = code | 0x40;
+                inverse = true;
             }
-            else {
-                // Normal (0x80-0xFF)
-                glyph_idx = chr & 0x7F; // Strip high bit
+            else if (code <= 0x7F) {
+                glyph = code & 0x3F;
+                inverse = flash;
             }
-
+            const uint32_t on = inverse ? background : foreground;
+            const uint32_t off = inverse ? foreground : background;
             for (int y = 0; y < 8; y++) {
-                uint8_t glyphRow = FONT[glyph_idx][y];
-                for (int x = 0; x < 7; x++) {
-                    int px = col * 7 + x;
-                    int py = row * 8 + y;
-                    pixels[py * WIDTH + px] = (glyphRow & (1 << (6 - x))) ? fg_color : bg_color;
+                for (int x = 0; x < 8; x++) { // The eighth is padding
+                    text_glyphs[flash][code][y][x] = x < 7 && FONT[glyph][y] & (1 << (6 - x)) ? on : off;
                 }
             }
         }
     }
 }
 
-/**
- * Draws the actual 7x8 character
- */
-void grapple_draw_char(uint8_t glyph_idx, int row, int col, uint32_t fg_color, uint32_t bg_color) {
-    for (int y = 0; y < 8; y++) {
-        uint8_t glyphRow = FONT[glyph_idx][y];
-        for (int x = 0; x < 7; x++) {
-            int px = col * 7 + x;
-            int py = row * 8 + y;
-            pixels[py * WIDTH + px] = (glyphRow & (1 << (6 - x))) ? fg_color : bg_color;
-        }
+// Copies a line of a glyph, all 8 pixels of it: the last goes over the next character's
+// first, so the one to its right has to be drawn after it
+static inline void text_copy_line_8(uint32_t* to, const uint32_t* from) {
+#if defined(__AVX2__)
+    _mm256_storeu_si256((__m256i*)to, _mm256_load_si256((const __m256i*)from));
+#elif defined(__SSE2__)
+    _mm_storeu_si128((__m128i*)to, _mm_load_si128((const __m128i*)from));
+    _mm_storeu_si128((__m128i*)(to + 4), _mm_load_si128((const __m128i*)(from + 4)));
+#else
+    for (int x = 0; x < 8; x++) {
+        to[x] = from[x];
     }
+#endif
 }
 
-
-void crapple_char_build_inverse() {
-    glyph_idx = chr | 0x40;
-    fg_color = 0xFF000000;
-    bg_color = 0xFF00FF00;
+// Copies just the 7 pixels of a line of a glyph, the second 4 over the first's last
+static inline void text_copy_line_7(uint32_t* to, const uint32_t* from) {
+#if defined(__SSE2__)
+    _mm_storeu_si128((__m128i*)to, _mm_load_si128((const __m128i*)from));
+    _mm_storeu_si128((__m128i*)(to + 3), _mm_loadu_si128((const __m128i*)(from + 3)));
+#else
+    for (int x = 0; x < 7; x++) {
+        to[x] = from[x];
+    }
+#endif
 }
 
-void crapple_char_build_flashing() {
-    glyph_idx = chr & 0x3F;
-    if (flash_on) {
-        fg_color = 0xFF000000;
-        bg_color = 0xFF00FF00;
+/**
+ * Draws text rows first to last - 1 of the page on screen, a scan line at a time.
+ */
+void crapple_draw_text_rows(const int first, const int last) {
+    const uint32_t (*glyphs)[8][8] = text_glyphs[flash_on];
+    const uint16_t offset = crapple_text_page_offset();
+    for (int row = first; row < last; row++) {
+        const uint8_t* codes = &MEMORY[row_start_addresses[row] + offset];
+        for (int y = 0; y < 8; y++) {
+            uint32_t* line = &pixels[(row * 8 + y) * WIDTH];
+            for (int col = 0; col < 39; col++) {
+                text_copy_line_8(&line[col * 7], glyphs[codes[col]][y]);
+            }
+            text_copy_line_7(&line[39 * 7], glyphs[codes[39]][y]); // Nothing right of it to go over
+        }
     }
 }
 
-void crapple_char_build_normal() {
-    glyph_idx = chr & 0x7F;
+/**
+ * Draws a character at row and col of the screen, just its 7 pixels wide.
+ */
+void crapple_draw_text_cell(const int row, const int col, const uint8_t code) {
+    const uint32_t (*glyph)[8] = text_glyphs[flash_on][code];
+    uint32_t* cell = &pixels[row * 8 * WIDTH + col * 7];
+    for (int y = 0; y < 8; y++) {
+        text_copy_line_7(&cell[y * WIDTH], glyph[y]);
+    }
 }
 
-void crapple_render_text_page(void) {
+/**
+ * Draws the text page where it differs from text_shadow: everything if the shadow is
+ * stale, else the characters that changed, and the flashing ones too if flash_on has.
+ * Returns whether any pixels changed.
+ */
+bool crapple_render_text_page(void) {
+    const uint16_t offset = crapple_text_page_offset();
+    if (!text_shadow.valid || text_shadow.graphics_mode != graphics_mode || text_shadow.mixed_mode != mixed_mode ||
+        text_shadow.page2 != page2) {
+        crapple_draw_text_rows(0, TEXT_ROWS);
+        lores_shadow.valid = false; // Likewise the graphics pages after this
+        hires_shadow.valid = false;
+        for (int row = 0; row < TEXT_ROWS; row++) {
+            memcpy(text_shadow.codes[row], &MEMORY[row_start_addresses[row] + offset], 40);
+        }
+        text_shadow.valid = true;
+        text_shadow.flash_on = flash_on;
+        text_shadow.graphics_mode = graphics_mode;
+        text_shadow.mixed_mode = mixed_mode;
+        text_shadow.page2 = page2;
+        crapple_dirty_clear(&text_shadow.seen, TEXT_PAGE1_START + offset, TEXT_PAGE_SIZE);
+        return true;
+    }
+
+    const bool flashed = text_shadow.flash_on != flash_on;
+    if (!flashed && !crapple_dirty(&text_shadow.seen, TEXT_PAGE1_START + offset, TEXT_PAGE_SIZE)) {
+        return false;
+    }
+    crapple_dirty_clear(&text_shadow.seen, TEXT_PAGE1_START + offset, TEXT_PAGE_SIZE);
+    bool changed = false;
     for (int row = 0; row < TEXT_ROWS; row++) {
+        const uint8_t* codes = &MEMORY[row_start_addresses[row] + offset];
+        if (!flashed && memcmp(codes, text_shadow.codes[row], 40) == 0) {
+            continue;
+        }
         for (int col = 0; col < 40; col++) {
-            chr = MEMORY[row_start_addresses[row] + col];
-            glyph_idx = chr;
-            fg_color = 0xFF00FF00; // Green
-            bg_color = 0xFF000000; // Black
-
-            if (chr <= 0x3F) crapple_char_build_inverse(); // Inverse
-            else if (chr >= 0x40 && chr <= 0x7F) crapple_char_build_flashing(); // Flashing
-            else crapple_char_build_normal(); // Normal
-
-            grapple_draw_char(glyph_idx, row, col, fg_color, bg_color);
+            const uint8_t code = codes[col];
+            if (code != text_shadow.codes[row][col] || (flashed && code >= 0x40 && code <= 0x7F)) {
+                crapple_draw_text_cell(row, col, code);
+                text_shadow.codes[row][col] = code;
+                changed = true;
+            }
         }
     }
+    text_shadow.flash_on = flash_on;
+    return changed;
 }
 
 
-void crapple_render_lores_page(void) {
-    const uint16_t base_addr = page2 ? TEXT_PAGE2_START : TEXT_PAGE1_START;
-
-    if (mixed_mode) {
-        // Draw 40x40 pixels on top (mixed mode is 40x40, full mode is 40x48 with no text)
-        // These are 2x2 pixels (280
-        for (int row = 0; row < LORES_HEIGHT_MIXED; row++) {
+void crapple_build_lores_lines(void) {
+    for (int color = 0; color < 16; color++) {
+        for (int x = 0; x < 8; x++) {
+            lores_lines[color][x] = lores_colors[color];
         }
+    }
+}
 
-        // Draw four text rows at bottom
-        for (int row = 20; row < TEXT_ROWS; row++) {
-            for (int col = 0; col < 40; col++) {
-                chr = MEMORY[row_start_addresses[row] + col];
-                glyph_idx = chr;
-                fg_color = 0xFF00FF00; // Green
-                bg_color = 0xFF000000; // Black
-
-                if (chr <= 0x3F) crapple_char_build_inverse(); // Inverse
-                else if (chr >= 0x40 && chr <= 0x7F) crapple_char_build_flashing(); // Flashing
-                else crapple_char_build_normal(); // Normal
-
-                grapple_draw_char(glyph_idx, row, col, fg_color, bg_color);
+/**
+ * Draws the lo-res page on screen, with text rows 20 to 23 in mixed mode, if it has
+ * changed since it was last drawn.  Returns whether it was drawn.
+ */
+bool crapple_render_lores_page(void) {
+    const uint16_t offset = crapple_text_page_offset();
+    if (lores_shadow.valid && lores_shadow.mixed_mode == mixed_mode && lores_shadow.page2 == page2 &&
+        (!mixed_mode || lores_shadow.flash_on == flash_on) &&
+        !crapple_dirty(&lores_shadow.seen, TEXT_PAGE1_START + offset, TEXT_PAGE_SIZE)) {
+        return false;
+    }
+    text_shadow.valid = false; // The others have to draw afresh after this
+    hires_shadow.valid = false;
+
+    const int rows = mixed_mode ? LORES_HEIGHT_MIXED / 2 : LORES_HEIGHT / 2;
+    for (int row = 0; row < rows; row++) {
+        const uint8_t* blocks = &MEMORY[row_start_addresses[row] + offset];
+        for (int y = 0; y < 8; y++) {
+            uint32_t* line = &pixels[(row * 8 + y) * WIDTH];
+            const int shift = y < 4 ? 0 : 4; // Top block, then bottom
+            for (int col = 0; col < 39; col++) {
+                text_copy_line_8(&line[col * 7], lores_lines[(blocks[col] >> shift) & 0x0F]);
             }
+            text_copy_line_7(&line[39 * 7], lores_lines[(blocks[39] >> shift) & 0x0F]);
         }
     }
-}
+    if (mixed_mode) {
+        crapple_draw_text_rows(rows, TEXT_ROWS);
+    }
 
-void crapple_render_lores_page_ERASEME(void) {
-    const uint16_t base_addr = page2 ? TEXT_PAGE2_START : TEXT_PAGE1_START;
-    for (int row = 0; row < LORES_HEIGHT; row += 2) {
-        // Two pixels per byte
-        for (int col = 0; col < LORES_WIDTH; col++) {
-            uint16_t addr = row_start_addresses[row / 2] + col - (page2 ? TEXT_PAGE1_START : 0);
-            uint8_t byte = MEMORY[base_addr + addr];
-            uint8_t top_color = byte & 0x0F; // Low nibble
-            uint8_t bottom_color = byte >> 4; // High nibble
+    lores_shadow.valid = true;
+    lores_shadow.flash_on = flash_on;
+    lores_shadow.mixed_mode = mixed_mode;
+    lores_shadow.page2 = page2;
+    crapple_dirty_clear(&lores_shadow.seen, TEXT_PAGE1_START + offset, TEXT_PAGE_SIZE);
+    return true;
+}
 
-            // Each lo-res pixel is 7x4 (text is 7x8, so halved vertically)
-            for (int y = 0; y < 4; y++) {
-                for (int x = 0; x < 7; x++) {
-                    int px = col * 7 + x;
-                    int py = row * 4 + y;
-                    pixels[py * WIDTH + px] = lores_colors[top_color];
+void crapple_build_hires_lines(void) {
+    for (int y = 0; y < HIRES_LINES; y++) { // Thirds of 8 rows of 8 lines, lines of a row 1K apart
+        hires_line_addresses[y] = HIRES_PAGE1_START + (y & 7) * 0x400 + ((y >> 3) & 7) * 0x80 + (y >> 6) * 0x28;
+    }
+    for (int index = 0; index < 2048; index++) {
+        const uint16_t bits = (index & 0x7F) << 1 | (index >> 8 & 1) | (index >> 9 & 1) << 8; // Left, byte, right
+        const bool second_palette = index & 0x80;
+        const bool odd = index >> 10 & 1;
+        for (int x = 0; x < 7; x++) {
+            uint32_t color = lores_colors[0]; // Black
+            if (bits >> (x + 1) & 1) {
+                if (bits >> x & 1 || bits >> (x + 2) & 1) {
+                    color = lores_colors[15]; // White
                 }
-            }
-            for (int y = 0; y < 4; y++) {
-                for (int x = 0; x < 7; x++) {
-                    int px = col * 7 + x;
-                    int py = (row + 1) * 4 + y;
-                    pixels[py * WIDTH + px] = lores_colors[bottom_color];
+                else if ((x & 1) == odd) { // An even column of the screen
+                    color = lores_colors[second_palette ? 6 : 3]; // Blue, violet
+                }
+                else {
+                    color = lores_colors[second_palette ? 9 : 12]; // Orange, green
                 }
             }
+            hires_lines[index][x] = color;
         }
+        hires_lines[index][7] = hires_lines[index][6];
     }
+}
 
-    // Mixed mode: bottom 4 text rows
-    if (mixed_mode) {
-        for (int row = 20; row < TEXT_ROWS; row++) {
-            for (int col = 0; col < 40; col++) {
-                uint8_t chr = MEMORY[row_start_addresses[row] + col];
-                uint8_t glyph_idx = chr <= 0x3F ? (chr | 0x40) : (chr & 0x7F);
-                uint32_t fg_color = (chr <= 0x3F) ? 0xFF000000 : 0xFF00FF00;
-                uint32_t bg_color = (chr <= 0x3F) ? 0xFF00FF00 : 0xFF000000;
-
-                for (int y = 0; y < 8; y++) {
-                    uint8_t glyphRow = FONT[glyph_idx][y];
-                    for (int x = 0; x < 7; x++) {
-                        int px = col * 7 + x;
-                        int py = row * 8 + y;
-                        pixels[py * WIDTH + px] = (glyphRow & (1 << (6 - x))) ? fg_color : bg_color;
-                    }
-                }
-            }
+/**
+ * Draws the hi-res page on screen, with text rows 20 to 23 in mixed mode, if it has
+ * changed since it was last drawn.  Returns whether it was drawn.
+ */
+bool crapple_render_hires_page(void) {
+    const uint16_t offset = page2 ? HIRES_PAGE2_START - HIRES_PAGE1_START : 0;
+    if (hires_shadow.valid && hires_shadow.mixed_mode == mixed_mode && hires_shadow.page2 == page2 &&
+        !crapple_dirty(&hires_shadow.seen, HIRES_PAGE1_START + offset, HIRES_PAGE_SIZE) &&
+        (!mixed_mode || (hires_shadow.flash_on == flash_on &&
+                         !crapple_dirty(&hires_shadow.seen, TEXT_PAGE1_START + crapple_text_page_offset(),
+                                        TEXT_PAGE_SIZE)))) {
+        return false;
+    }
+    text_shadow.valid = false; // The others have to draw afresh after this
+    lores_shadow.valid = false;
+
+    const int lines = mixed_mode ? HIRES_LINES_MIXED : HIRES_LINES;
+    for (int y = 0; y < lines; y++) {
+        const uint8_t* bytes = &MEMORY[hires_line_addresses[y] + offset];
+        uint32_t* line = &pixels[y * WIDTH];
+        int left = 0; // The pixels either side of each byte, none off the ends
+        for (int col = 0; col < 39; col++) {
+            const int index = bytes[col] | left << 8 | (bytes[col + 1] & 1) << 9 | (col & 1) << 10;
+            text_copy_line_8(&line[col * 7], hires_lines[index]);
+            left = bytes[col] >> 6 & 1;
         }
+        text_copy_line_7(&line[39 * 7], hires_lines[bytes[39] | left << 8 | 1 << 10]);
     }
+    if (mixed_mode) {
+        crapple_draw_text_rows(HIRES_LINES_MIXED / 8, TEXT_ROWS);
+    }
+
+    hires_shadow.valid = true;
+    hires_shadow.flash_on = flash_on;
+    hires_shadow.mixed_mode = mixed_mode;
+    hires_shadow.page2 = page2;
+    crapple_dirty_clear(&hires_shadow.seen, HIRES_PAGE1_START + offset, HIRES_PAGE_SIZE);
+    crapple_dirty_clear(&hires_shadow.seen, TEXT_PAGE1_START + crapple_text_page_offset(), TEXT_PAGE_SIZE);
+    return true;
 }
 
 int crapple_load_char_rom() {
@@ -784,6 +1931,70 @@ int crapple_load_fp_basic_rom() {
     return 0;
 }
 
+int crapple_load_program(const char* path) {
+    // Tokenize an Applesoft listing into memory
+    FILE* file = fopen(path, "rb");
+    if (!file) {
+        program_load_failed = errno != ENOENT; // Nothing to lose if there's no file yet
+        fprintf(stderr, "Program file %s open failed: %s\n", path, strerror(errno));
+        return 1;
+    }
+
+    program_load_failed = true;
+    fseek(file, 0, SEEK_END);
+    const long size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    char* text = size > 0 ? malloc(size) : NULL;
+    if (!text || fread(text, 1, size, file) != (size_t)size) {
+        fprintf(stderr, "Program file %s read failed\n", path);
+        free(text);
+        fclose(file);
+        return 1;
+    }
+    fclose(file);
+
+    const bool loaded = applesoft_load_program(&context, MEMORY, text, size);
+    free(text);
+    if (!loaded) {
+        return 1;
+    }
+    program_load_failed = false;
+    printf("Loaded %s\n", path);
+    return 0;
+}
+
+int crapple_save_program(const char* path) {
+    // Write the Applesoft program in memory out as a listing
+    FILE* file = fopen(path, "w");
+    if (!file) {
+        fprintf(stderr, "Program file %s open failed: %s\n", path, strerror(errno));
+        return 1;
+    }
+    const bool saved = applesoft_save_program(MEMORY, file);
+    if (fclose(file) != 0 || !saved) {
+        fprintf(stderr, "Program file %s write failed\n", path);
+        return 1;
+    }
+    printf("Saved %s\n", path);
+    return 0;
+}
+
+/**
+ * Loads program_path the first time Applesoft gets to its prompt, once its cold start
+ * has set up TXTTAB and HIMEM, then removes itself and lets the ROM carry on.
+ */
+static bool crapple_program_trap(MCS6502ExecutionContext* cpu, int cycle_budget, void* data) {
+    MCS6502SetTrap(cpu, APPLESOFT_RESTART, NULL, NULL);
+    crapple_load_program(program_path);
+    return false;
+}
+
+void crapple_install_program_load() {
+    if (!MCS6502SetTrap(&context, APPLESOFT_RESTART, crapple_program_trap, NULL)) {
+        fprintf(stderr, "No room for a trap, not loading %s\n", program_path);
+    }
+}
+
 void crapple_test() {
     // just for testing stuff
 
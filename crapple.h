@@ -7,6 +7,7 @@
 #include "font.h"
 #include "res/int_basic.h"
 #include "res/fp_basic.h"
+#include "applesoft.h"
 
 // Debugging
 
@@ -33,12 +34,32 @@ uint32_t pixels[WIDTH * HEIGHT]; // ARGB8888 format
 // Timing
 // CPU update: Run ~17,050 cycles per frame @ ~60FPS.  Tweak for your system.
 static int cycles_per_frame = 17050; // Adjustable
+static uint64_t frame_end_cycle = 0; // total_cycles at which this frame's CPU time ends
 static uint64_t total_cycles = 0; // Total 6502 cycles executed
 static Uint32 last_time = 0; // Last measurement time (ms)
 static double current_mhz = 0.0; // Calculated MHz
 static int frame_counter = 0; // Frames since last update
 #define UPDATE_INTERVAL 60            // Update MHz every 60 frames (1 sec at 60 FPS)
 
+// Scheduler
+// Devices post callbacks for a future value of total_cycles. The frame loop runs the CPU
+// in one batch up to the next deadline (or the end of the frame) and then fires whatever
+// is due, so nothing has to be polled per instruction.
+typedef void (*crapple_event_fn)(uint64_t cycle, void* data);
+typedef struct {
+    uint64_t cycle; // Fires once total_cycles reaches this
+    uint32_t order; // Events due on the same cycle fire in the order they were posted
+    crapple_event_fn fn;
+    void* data;
+} crapple_event;
+#define MAX_EVENTS 64
+static crapple_event event_heap[MAX_EVENTS]; // Min-heap on (cycle, order)
+static int event_count = 0;
+static uint32_t event_order = 0;
+bool crapple_schedule(uint64_t cycle, crapple_event_fn fn, void* data);
+uint64_t crapple_next_event_cycle();
+void crapple_run_due_events();
+
 // Keyboard
 #define MAX_PASTE_BUFFER 4096  // Max characters to paste
 static char paste_buffer[MAX_PASTE_BUFFER]; // Buffer for clipboard text
@@ -49,6 +70,145 @@ static uint8_t keyboard_data = 0x00; // Last key pressed
 static bool key_available = false; // Key ready flag
 void simulate_key_press(uint8_t key);
 
+// Programs
+// An Applesoft listing on the host is tokenized straight into memory (see applesoft.h)
+// instead of being pasted a key at a time: the one given with --bas when Applesoft
+// first gets to its prompt, and the same file again with F5. F6 writes the program in
+// memory back to it, unless the file is there but its last load failed, so a listing
+// with a typo isn't replaced by whatever was in memory.
+#define DEFAULT_PROGRAM_PATH "program.bas"
+static const char* program_path = DEFAULT_PROGRAM_PATH;
+static bool program_at_start = false; // Load program_path once Applesoft has started
+static bool program_load_failed = false; // The last load of program_path found it and failed
+int crapple_load_program(const char* path);
+int crapple_save_program(const char* path);
+void crapple_install_program_load();
+
+// Idle detection
+// At a prompt the Monitor's KEYIN loop spins on $C000, bumping the RNDL/RNDH seed, until
+// a key arrives. Keys only arrive between CPU batches, so once a batch stops on a poll
+// that found nothing, the rest of the batch would just be more of the same loop and can
+// be skipped, with the seed and cycle count it would have left.
+#define KEYIN_LOOP 0xFD1B // INC RNDL / BNE / INC RNDH / BIT KBD / BPL KEYIN
+#define KEYIN_POLL 0xFD21 // BIT KBD
+#define RNDL 0x4E
+static const uint8_t keyin_code[] = {0xE6, 0x4E, 0xD0, 0x02, 0xE6, 0x4F, 0x2C, 0x00, 0xC0, 0x10, 0xF5};
+static bool keyin_polling = false; // KEYIN found no key and stopped the CPU
+int crapple_skip_keyin(int cycles);
+
+// The Monitor's WAIT delays 2.5A^2 + 13.5A + 7 cycles counting A down in nested loops,
+// for the bell among others. It is trapped at its entry and at its outer loop, where a
+// wait that runs past the end of the CPU batch carries on in the next.
+#define WAIT 0xFCA8
+#define WAIT_LOOP 0xFCA9 // PHA / SBC #1 / BNE *-2 / PLA / SBC #1 / BNE WAIT_LOOP
+static const uint8_t wait_code[] = {0x38, 0x48, 0xE9, 0x01, 0xD0, 0xFC, 0x68, 0xE9, 0x01, 0xD0, 0xF6, 0x60};
+void crapple_install_wait_skip();
+
+// High-level emulation
+// Traps the Monitor's text output routines and does their work natively, leaving memory,
+// the zero page cursor state and A/Y/P as the ROM code would. Each call is charged
+// roughly what the 6502 code takes.
+// #define USE_HLE
+#define HLE_COUT_CYCLES 75      // COUT1 ($FDF0), one character without scrolling
+#define HLE_SCROLL_CYCLES 17700 // SCROLL ($FC70), also charged when COUT1 scrolls
+#define HLE_HOME_CYCLES 15800   // HOME ($FC58)
+#define HLE_CLREOL_CYCLES 570   // CLREOL ($FC9C), from the start of a 40 column line
+// Monitor zero page
+#define ZP_WNDLFT 0x20
+#define ZP_WNDWDTH 0x21
+#define ZP_WNDTOP 0x22
+#define ZP_WNDBTM 0x23
+#define ZP_CH 0x24
+#define ZP_CV 0x25
+#define ZP_BASL 0x28
+#define ZP_BAS2L 0x2A
+#define ZP_INVFLG 0x32
+#define ZP_YSAV1 0x35
+typedef struct {
+    uint8_t a, y;
+    bool n, z, c, v;
+    int cycles; // Charged on return
+    uint16_t dirty_low, dirty_high; // Written pages, to invalidate on return
+} crapple_hle_state;
+void crapple_install_hle();
+
+// Run Applesoft's floating point add, multiply and divide natively (see applesoft.h)
+// #define USE_FAST_FP
+
+// Compact Applesoft's string space natively when it runs out (see applesoft.h)
+// #define USE_FAST_GARBAG
+
+// Look up Applesoft's GOTO and GOSUB targets in an index of the program (see applesoft.h)
+// #define USE_LINE_INDEX
+
+// Look up Applesoft's variables and arrays in hash indexes (see applesoft.h)
+// #define USE_VARIABLE_INDEX
+
+// Profiling
+// Where a running Applesoft program spends its time. Every PROFILE_SAMPLE_CYCLES of
+// total_cycles, the cycles since the last sample go to the line in CURLIN and to the part
+// of memory the PC is in; a trap where NEWSTT moves on to the next line
+// counts the times each line runs. The report goes to PROFILE_PATH on F7 and at exit.
+// #define USE_BASIC_PROFILER
+#define PROFILE_SAMPLE_CYCLES 500
+#define PROFILE_PATH "profile.txt"
+#define PROFILE_NEWLINE 0xD7FC // NEWSTT with CURLIN ($75) just set to the next line
+#define PROFILE_DIRECT 0xFF // CURLIN's high byte in direct mode
+#ifdef USE_BASIC_PROFILER
+typedef struct {
+    uint16_t first, last;
+    const char* name;
+} crapple_profile_area;
+static const crapple_profile_area profile_areas[] = { // The first that holds the PC
+    {0xE484, 0xE596, "String garbage collection"},
+    {0xE7A0, 0xF10A, "Floating point and number conversion"},
+    {0xF800, 0xFFFF, "Monitor: screen, keyboard and other I/O"},
+    {0xD000, 0xF7FF, "Interpreter"},
+    {0x00B1, 0x00C8, "Interpreter"}, // CHRGET
+    {0x0000, 0xCFFF, "Machine code and I/O space"},
+};
+#define PROFILE_AREAS (sizeof(profile_areas) / sizeof(profile_areas[0]))
+static struct {
+    uint64_t last_cycle; // total_cycles at the last sample
+    bool in_program; // From the first line NEWSTT moves on to until direct mode
+    uint64_t total, running; // Cycles sampled, and of those with a program running
+    uint64_t line_cycles[0x10000];
+    uint32_t line_hits[0x10000];
+    uint64_t area_cycles[PROFILE_AREAS];
+} profile;
+void crapple_install_basic_profiler();
+int crapple_write_profile(const char* path);
+#endif
+
+// Count every instruction run by opcode and by address (see MCS6502EnableCounters) and
+// write the counts and which ROM bytes ran as code to COUNTERS_PATH.csv/.json on F8 and
+// at exit. Shift+F8 starts the counts again. The CPU interprets every instruction.
+// #define USE_COUNTERS
+#define COUNTERS_PATH "counters"
+#define COUNTERS_ROM_START 0xD000 // Coverage is of $D000-$FFFF
+#ifdef USE_COUNTERS
+int crapple_write_counters(const char* path);
+#endif
+
+// Keep a call graph of the routines run (see MCS6502EnableCallGraph) and write it to
+// CALLS_PATH on F9 and at exit: .folded has a line per chain of calls with the cycles
+// run in its last routine, for flame graph tools, and .csv the calls and the cycles
+// inclusive and exclusive of each routine. Routines are named from whichever of the
+// symbol maps (an address and a name per line) can be read. Shift+F9 starts again. The
+// CPU interprets every instruction.
+// #define USE_CALL_GRAPH
+#define CALLS_PATH "calls"
+#ifdef USE_CALL_GRAPH
+static const char* call_symbol_maps[] = {"res/monitor.sym", "res/applesoft.sym"};
+static char* call_symbols[0x10000]; // Names by address, NULL if none
+void crapple_load_call_symbols();
+int crapple_write_call_graph(const char* path);
+#endif
+
+#if defined(USE_COUNTERS) || defined(USE_CALL_GRAPH)
+#define MCS6502_COUNTERS
+#endif
+
 
 //  Reference
 //  https://grok.com/share/bGVnYWN5_eef0322c-1ebb-40d3-9eae-1d92acc84400
@@ -64,11 +224,32 @@ bool crapple_running = true;
 uint8_t* activeTextPage = &MEMORY[TEXT_PAGE1_START]; // Default to Page 1
 
 int crapple_init();
+void crapple_map_memory();
 void crapple_update();
 void crapple_terminate();
 uint16_t getTextAddress(const uint8_t col, const uint8_t row);
 void crapple_test();
 
+// Dirty pages
+// What changed in memory, a 256-byte page at a time, for consumers such as the
+// renderers, savestate deltas or remote viewers to do work in proportion to it. Every
+// write the CPU makes bumps its page's generation (see pageWriteGenerations), and host
+// code that writes memory calls MCS6502InvalidatePages, so tracking costs the write
+// path nothing more. Each consumer keeps a crapple_dirty_pages of its own with the
+// generations it has seen, so one clearing what it has dealt with leaves the others be.
+// Ranges are an address and a length in bytes, rounded out to whole pages.
+#define TEXT_PAGE_SIZE 0x0400
+#define HIRES_PAGE1_START 0x2000
+#define HIRES_PAGE2_START 0x4000
+#define HIRES_PAGE_SIZE 0x2000
+typedef struct {
+    unsigned int generations[256]; // pageWriteGenerations as of the last clear
+} crapple_dirty_pages;
+static uint64_t dirty_frame = 0; // Frames run, e.g. to number the deltas a consumer sends on
+bool crapple_dirty(const crapple_dirty_pages* seen, uint16_t start, uint32_t length);
+int crapple_dirty_bitmap(const crapple_dirty_pages* seen, uint64_t bitmap[4]);
+void crapple_dirty_clear(crapple_dirty_pages* seen, uint16_t start, uint32_t length);
+
 // Display
 #define LORES_WIDTH 40
 #define LORES_HEIGHT 48
@@ -83,21 +264,41 @@ const uint16_t row_start_addresses[] = {
 bool graphics_mode = false; // $C050 (on) vs $C051 (off)
 bool mixed_mode = false; // $C053 (on) vs $C052 (off)
 bool page2 = false; // $C055 (on) vs $C054 (off)
+bool hires_mode = false; // $C057 (on) vs $C056 (off)
 
-uint8_t chr; // TODO come up with better names
-uint8_t glyph_idx;
-uint32_t fg_color;
-uint32_t bg_color;
-void crapple_render_text_page_1();
-void crapple_render_text_page(void);
-void crapple_render_lores_page(void);
-void grapple_draw_char(uint8_t glyph_idx, int row, int col, uint32_t fg_color, uint32_t bg_color);
-void crapple_char_build_inverse();
-void crapple_char_build_flashing();
-void crapple_char_build_normal();
+bool crapple_render_text_page(void);
+bool crapple_render_lores_page(void);
+bool crapple_render_hires_page(void);
 uint8_t cursor_timer = 0;
 static bool flash_on;
 
+// Text is drawn from the font expanded into ARGB tiles when it's loaded, one per screen
+// code for each phase of flashing, so a character is copied a line of 7 pixels at a
+// time. Lines are padded to 8 pixels for 128-bit (SSE2) or 256-bit (AVX2, build with
+// -mavx2) loads and stores; other CPUs copy a pixel at a time.
+#define TEXT_FOREGROUND 0xFF00FF00 // Green
+#define TEXT_BACKGROUND 0xFF000000 // Black
+static _Alignas(32) uint32_t text_glyphs[2][256][8][8]; // By flash_on, screen code, line and pixel
+void crapple_build_text_glyphs(uint32_t foreground, uint32_t background);
+void crapple_draw_text_rows(int first, int last);
+void crapple_draw_text_cell(int row, int col, uint8_t code);
+
+// The text and lo-res page on screen, as an offset from page 1's addresses
+static inline uint16_t crapple_text_page_offset(void) {
+    return page2 ? TEXT_PAGE2_START - TEXT_PAGE1_START : 0;
+}
+
+// The text page as last drawn, with the switches and phase of flashing it was drawn in,
+// so a frame only draws what changed and an idle one costs a compare of 960 bytes. Set
+// valid to false when anything else draws over the screen.
+static struct {
+    bool valid;
+    bool flash_on;
+    bool graphics_mode, mixed_mode, page2;
+    uint8_t codes[TEXT_ROWS][40];
+    crapple_dirty_pages seen; // Only the text page, a frame where it wasn't written is skipped
+} text_shadow;
+
 // Apple II lo-res colors (ARGB8888, approximate RGB from hardware)
 static const uint32_t lores_colors[16] = {
     0xFF000000, // 0: Black
@@ -118,6 +319,40 @@ static const uint32_t lores_colors[16] = {
     0xFFFFFFFF // 15: White
 };
 
+// Lo-res is drawn like text: each byte is a block 7 pixels wide of two colors, the low
+// nibble over the high, 4 scan lines each, and a line of a block is copied from a line
+// of 8 pixels of its color. Mixed mode has 40 rows of blocks over four of text; full
+// screen has 48. As long as the page isn't written, nor the switches or flashing
+// (in the text below) changed, frames draw nothing.
+static _Alignas(32) uint32_t lores_lines[16][8]; // By color
+static struct {
+    bool valid;
+    bool flash_on;
+    bool mixed_mode, page2;
+    crapple_dirty_pages seen;
+} lores_shadow;
+void crapple_build_lores_lines(void);
+
+// Hi-res is 192 lines of 40 bytes, each 7 pixels (bit 0 leftmost) in one of two
+// palettes picked by bit 7. A pixel that's on next to another that's on is white, one
+// on alone is colored by whether its column is even or odd: violet or green, or blue or
+// orange in the second palette. Off pixels are black. Lines are drawn a byte at a time
+// from a table of their 7 pixels (padded to 8 like text) for every byte, the pixels
+// either side of it and the evenness of its column. Mixed mode has 160 lines over four
+// of text. Frames draw nothing as long as the page isn't written, nor the switches or
+// the text below changed.
+#define HIRES_LINES 192
+#define HIRES_LINES_MIXED 160
+static uint16_t hires_line_addresses[HIRES_LINES]; // In page 1
+static _Alignas(32) uint32_t hires_lines[2048][8]; // By byte, left, right and odd bits above it
+static struct {
+    bool valid;
+    bool flash_on;
+    bool mixed_mode, page2;
+    crapple_dirty_pages seen;
+} hires_shadow;
+void crapple_build_hires_lines(void);
+
 // Audio
 static uint32_t cycle_count = 0;
 static uint32_t last_toggle_cycle = 0;
@@ -150,18 +385,25 @@ void writeBytesFn(uint16_t address, uint8_t value, void* context);
 inline uint8_t readBytesFn(uint16_t address, void* context) {
     // @formatter:off
     // Keyboard data - Bit 7 set if key available
-    if (address == 0xC000) { return key_available ? (keyboard_data | 0x80) : 0x00; }
+    if (address == 0xC000) {
+        if (key_available) { return keyboard_data | 0x80; }
+        if (((MCS6502ExecutionContext*)context)->pc == KEYIN_POLL) { keyin_polling = true; MCS6502StopRun(context); }
+        return 0x00;
+    }
     // Keyboard strobe - Clear key on read
     if (address == 0xC010) { key_available = false; return 0x00; }
 
     // SOFT SWITCHES
-    if (address == 0xC030) { speaker_state = !speaker_state; speaker_toggle = true; return MEMORY[address]; }
-    if (address == 0xC050) { graphics_mode = true; return MEMORY[address]; }    // GR sets this
-    if (address == 0xC051) { graphics_mode = false; return MEMORY[address]; }
-    if (address == 0xC052) { mixed_mode = false; return MEMORY[address]; }
-    if (address == 0xC053) { mixed_mode = true; return MEMORY[address]; }
-    if (address == 0xC054) { page2 = false; return MEMORY[address]; }
-    if (address == 0xC055) { page2 = true; return MEMORY[address]; }
+    // These also end the current MCS6502Run() batch so crapple_update can react to them.
+    if (address == 0xC030) { speaker_state = !speaker_state; speaker_toggle = true; MCS6502StopRun(context); return MEMORY[address]; }
+    if (address == 0xC050) { graphics_mode = true; MCS6502StopRun(context); return MEMORY[address]; }    // GR sets this
+    if (address == 0xC051) { graphics_mode = false; MCS6502StopRun(context); return MEMORY[address]; }
+    if (address == 0xC052) { mixed_mode = false; MCS6502StopRun(context); return MEMORY[address]; }
+    if (address == 0xC053) { mixed_mode = true; MCS6502StopRun(context); return MEMORY[address]; }
+    if (address == 0xC054) { page2 = false; MCS6502StopRun(context); return MEMORY[address]; }
+    if (address == 0xC055) { page2 = true; MCS6502StopRun(context); return MEMORY[address]; }
+    if (address == 0xC056) { hires_mode = false; MCS6502StopRun(context); return MEMORY[address]; }
+    if (address == 0xC057) { hires_mode = true; MCS6502StopRun(context); return MEMORY[address]; }
 
     return MEMORY[address];
     // @formatter:on
@@ -174,16 +416,18 @@ inline void writeBytesFn(uint16_t address, uint8_t value, void* context) {
     if (address == 0xC010) { key_available = false; return; }
 
     // SOFT SWITCH toggle speaker
-    if (address == 0xC030) { speaker_state = !speaker_state; speaker_toggle = true; return; }
-    if (address == 0xC050) { graphics_mode = true; return; }
-    if (address == 0xC051) { graphics_mode = false; return; }
-    if (address == 0xC052) { mixed_mode = false; return; }
-    if (address == 0xC053) { mixed_mode = true; return; }
-    if (address == 0xC054) { page2 = false; return; }
-    if (address == 0xC055) { page2 = true; return; }
-
-    // Normal writes outside I/O
-    if (address < 0xC000 || address > 0xCFFF) { MEMORY[address] = value; }
+    if (address == 0xC030) { speaker_state = !speaker_state; speaker_toggle = true; MCS6502StopRun(context); return; }
+    if (address == 0xC050) { graphics_mode = true; MCS6502StopRun(context); return; }
+    if (address == 0xC051) { graphics_mode = false; MCS6502StopRun(context); return; }
+    if (address == 0xC052) { mixed_mode = false; MCS6502StopRun(context); return; }
+    if (address == 0xC053) { mixed_mode = true; MCS6502StopRun(context); return; }
+    if (address == 0xC054) { page2 = false; MCS6502StopRun(context); return; }
+    if (address == 0xC055) { page2 = true; MCS6502StopRun(context); return; }
+    if (address == 0xC056) { hires_mode = false; MCS6502StopRun(context); return; }
+    if (address == 0xC057) { hires_mode = true; MCS6502StopRun(context); return; }
+
+    // Normal writes outside I/O and ROM (RAM is normally mapped directly, see crapple_map_memory)
+    if (address < 0xC000) { MEMORY[address] = value; }
     // @formatter:on
 }
 
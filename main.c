@@ -1,7 +1,18 @@
 #include <stdio.h>
 #include "crapple.c"
 
-int main(void) {
+int main(int argc, char* argv[]) {
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--bas") == 0 && i + 1 < argc) {
+            program_path = argv[++i];
+            program_at_start = true;
+        }
+        else {
+            fprintf(stderr, "Usage: %s [--bas program.bas]\n", argv[0]);
+            return 1;
+        }
+    }
+
     crapple_test();
 
     if (crapple_init() != 0) {
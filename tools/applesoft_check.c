@@ -0,0 +1,42 @@
+//
+//  applesoft_check.c
+//
+//  Differential test of the native Applesoft routines. The checks themselves live in
+//  applesoft.c next to the code they test, behind the APPLESOFT_CHECK_* defines below:
+//  each runs a native routine and the ROM code it replaces on the same random operands,
+//  string spaces, programs, variable tables or lines, over a copy of FP_BASIC_ROM, and
+//  compares memory, registers and flags. This calls them in turn, prints how many
+//  differences each found (the first few in full on stderr) and exits nonzero on any.
+//
+
+#define APPLESOFT_CHECK_FP
+#define APPLESOFT_CHECK_GARBAG
+#define APPLESOFT_CHECK_FNDLIN
+#define APPLESOFT_CHECK_PTRGET
+#define APPLESOFT_CHECK_PARSE
+#include "../MCS6502.c"
+#include "../applesoft.c"
+
+static uint8_t memory[0x10000];
+
+static const struct {
+    const char* name;
+    int (*check)(const uint8_t* memory);
+} checks[] = {
+    {"FADDT, FMULTT and FDIVT", applesoft_check_fp},
+    {"GARBAG", applesoft_check_garbag},
+    {"FNDLIN", applesoft_check_fndlin},
+    {"PTRGET's variable and array scans", applesoft_check_ptrget},
+    {"PARSE", applesoft_check_parse},
+};
+
+int main(void) {
+    memcpy(&memory[0xD000], FP_BASIC_ROM, sizeof(FP_BASIC_ROM));
+    int failures = 0;
+    for (size_t i = 0; i < sizeof(checks) / sizeof(checks[0]); i++) {
+        const int differences = checks[i].check(memory);
+        printf("%s: %d differences from the ROM\n", checks[i].name, differences);
+        failures += differences;
+    }
+    return failures != 0;
+}
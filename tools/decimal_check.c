@@ -0,0 +1,24 @@
+//
+//  decimal_check.c
+//
+//  Exhaustive test of the tables behind decimal-mode ADC and SBC: all 2 x 2 x 256 x 256
+//  combinations of operation, carry in, accumulator and operand go through the immediate
+//  ADC and SBC handlers and are compared with the NMOS reference functions in MCS6502.c,
+//  and with plain decimal arithmetic where both operands are valid BCD. Mismatches are
+//  printed as found and make the exit status nonzero.
+//
+
+#define MCS6502_CHECK_DECIMAL
+#include "../MCS6502.c"
+#include "tools.h"
+
+static uint8 memory[0x10000];
+
+int main(void) {
+    MCS6502ExecutionContext cpu;
+    MCS6502Init(&cpu, flat_read, flat_write, memory); // Builds the tables
+
+    const int failures = CheckDecimalMode();
+    printf("%d of %d decimal ADC and SBC results differ\n", failures, 2 * 2 * 256 * 256);
+    return failures != 0;
+}
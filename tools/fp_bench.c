@@ -0,0 +1,115 @@
+//
+//  fp_bench.c
+//
+//  How much the native FADDT, FMULTT and FDIVT in applesoft.c save. Each routine, and
+//  SQR, LOG, EXP and SIN, which run on those three, is called from a JSR on the same
+//  random arguments by two interpreted CPUs over a copy of FP_BASIC_ROM, one of them
+//  with the traps installed. The table gives the average emulated cycles and host
+//  nanoseconds per call for each CPU and the ratio of each pair.
+//
+
+#include "../MCS6502.c"
+#include "../applesoft.c"
+#include "tools.h"
+
+#define CALLS 5000
+
+static uint8_t memory[0x10000];
+
+// Stores value as an unpacked float (exponent, four bytes of mantissa, sign) at address
+static void store_float(const uint16_t address, const double value) {
+    double mantissa = value < 0 ? -value : value;
+    int exponent = 0;
+    for (; mantissa >= 1; mantissa /= 2) {
+        exponent++;
+    }
+    for (; mantissa != 0 && mantissa < 0.5; mantissa *= 2) {
+        exponent--;
+    }
+    const uint32_t bits = (uint32_t)(mantissa * 4294967296.0);
+    memory[address] = value == 0 ? 0 : exponent + 0x80;
+    memory[address + 1] = bits >> 24;
+    memory[address + 2] = bits >> 16;
+    memory[address + 3] = bits >> 8;
+    memory[address + 4] = bits;
+    memory[address + 5] = value < 0 ? 0xFF : 0;
+}
+
+// A random value from low to high
+static double random_value(const double low, const double high) {
+    return low + (high - low) * rand() / RAND_MAX;
+}
+
+// Calls the routine at entry from a JSR at $0300 with FAC, ARG and A set up as the ROM
+// does for it, and runs it to its return. Returns the cycles it took.
+static long call(MCS6502ExecutionContext* cpu, const uint16_t entry, const double fac, const double arg) {
+    store_float(0x9D, fac);
+    store_float(0xA5, arg);
+    memory[0xAB] = memory[0xA2] ^ memory[0xAA];
+    memory[0xAC] = 0;
+    memory[0x1F0] = 0x03;
+    memory[0x1EF] = 0x02;
+    cpu->sp = 0xEE;
+    cpu->pc = entry;
+    cpu->a = memory[0x9D];
+    cpu->p = 0x20 | (cpu->a ? 0 : MCS6502_STATUS_Z);
+    long cycles = 0;
+    while (cpu->pc != 0x0303 && cpu->pc != 0xD412) {
+        MCS6502ExecNext(cpu);
+        cycles += cpu->timingForLastOperation;
+    }
+    return cycles;
+}
+
+int main(void) {
+    static const struct {
+        const char* name;
+        uint16_t entry;
+        double low, high;
+    } routines[] = {
+        {"FADDT", APPLESOFT_FADDT, -1000, 1000},
+        {"FMULTT", APPLESOFT_FMULTT, -1000, 1000},
+        {"FDIVT", APPLESOFT_FDIVT, -1000, 1000},
+        {"SQR", 0xEE8D, 0.001, 10000},
+        {"LOG", 0xE941, 0.001, 10000},
+        {"EXP", 0xEF09, -80, 80},
+        {"SIN", 0xEFF1, -100, 100},
+    };
+    static double facs[CALLS], args[CALLS];
+    memcpy(&memory[0xD000], FP_BASIC_ROM, sizeof(FP_BASIC_ROM));
+    MCS6502ExecutionContext rom, native;
+    MCS6502Init(&rom, flat_read, flat_write, memory);
+    MCS6502Init(&native, flat_read, flat_write, memory);
+    if (!applesoft_install_fast_fp(&native, memory)) {
+        fprintf(stderr, "No floating point package to trap\n");
+        return 1;
+    }
+
+    printf("routine   ROM cycles   native cycles   speedup   ROM ns   native ns   speedup\n");
+    for (size_t i = 0; i < sizeof(routines) / sizeof(routines[0]); i++) {
+        srand(6502);
+        for (int c = 0; c < CALLS; c++) {
+            facs[c] = random_value(routines[i].low, routines[i].high);
+            args[c] = random_value(routines[i].low, routines[i].high);
+        }
+
+        long rom_cycles = 0;
+        double start = seconds();
+        for (int c = 0; c < CALLS; c++) {
+            rom_cycles += call(&rom, routines[i].entry, facs[c], args[c]);
+        }
+        const double rom_time = (seconds() - start) / CALLS;
+
+        long native_cycles = 0;
+        start = seconds();
+        for (int c = 0; c < CALLS; c++) {
+            native_cycles += call(&native, routines[i].entry, facs[c], args[c]);
+        }
+        const double native_time = (seconds() - start) / CALLS;
+
+        printf("%-7s   %10ld   %13ld   %6.1fx   %6.0f   %9.0f   %6.1fx\n", routines[i].name, rom_cycles / CALLS,
+               native_cycles / CALLS, (double)rom_cycles / native_cycles, rom_time * 1e9, native_time * 1e9,
+               rom_time / native_time);
+    }
+    return 0;
+}
@@ -0,0 +1,89 @@
+//
+//  hires_bench.c
+//
+//  Checks crapple_render_hires_page on pairs of bytes whose pixels were worked out by
+//  hand, each pair on a line of its own: lone pixels in both palettes and on even and
+//  odd columns, runs that turn white, and pixels either side of a byte boundary and at
+//  the ends of a line. Any pixel that differs is reported and stops it. Then it times
+//  full frames (192 lines of 40 bytes) of random bytes, redrawn from scratch each time.
+//
+
+#include "../crapple.c"
+#include "tools.h"
+
+#define FRAMES 20000
+
+// Two bytes at column col of a line and the 14 pixels they draw, all others black:
+// K black, W white, P purple, B blue, G green and O orange
+static const struct {
+    int col;
+    uint8_t bytes[2];
+    const char* colors;
+} patterns[] = {
+    {0, {0x01, 0x00}, "PKKKKKK" "KKKKKKK"}, // A lone pixel takes its column's color
+    {0, {0x02, 0x00}, "KGKKKKK" "KKKKKKK"},
+    {0, {0x81, 0x00}, "BKKKKKK" "KKKKKKK"}, // The high bit picks the other palette
+    {0, {0x82, 0x00}, "KOKKKKK" "KKKKKKK"},
+    {0, {0x55, 0x00}, "PKPKPKP" "KKKKKKK"},
+    {0, {0x2A, 0x80}, "KGKGKGK" "KKKKKKK"},
+    {0, {0x03, 0x00}, "WWKKKKK" "KKKKKKK"}, // Pixels next to each other are white
+    {0, {0x7F, 0x00}, "WWWWWWW" "KKKKKKK"},
+    {0, {0x0D, 0x00}, "PKWWKKK" "KKKKKKK"},
+    {0, {0x40, 0x00}, "KKKKKKP" "KKKKKKK"},
+    {0, {0x00, 0x01}, "KKKKKKK" "GKKKKKK"}, // The second byte starts on an odd column
+    {0, {0x00, 0x81}, "KKKKKKK" "OKKKKKK"},
+    {0, {0x40, 0x01}, "KKKKKKW" "WKKKKKK"}, // Across the byte boundary
+    {0, {0xC0, 0x01}, "KKKKKKW" "WKKKKKK"},
+    {0, {0x40, 0x02}, "KKKKKKP" "KPKKKKK"},
+    {19, {0x40, 0x01}, "KKKKKKW" "WKKKKKK"},
+    {20, {0x81, 0x00}, "BKKKKKK" "KKKKKKK"}, // Columns alternate between the two
+    {21, {0x81, 0x00}, "OKKKKKK" "KKKKKKK"},
+    {38, {0x40, 0x01}, "KKKKKKW" "WKKKKKK"}, // The last bytes of the line
+    {38, {0x00, 0x40}, "KKKKKKK" "KKKKKKG"},
+    {38, {0x00, 0xC0}, "KKKKKKK" "KKKKKKO"},
+    {38, {0x00, 0x60}, "KKKKKKK" "KKKKKWW"},
+};
+
+static uint32_t color_of(const char letter) {
+    switch (letter) {
+        case 'W': return lores_colors[15];
+        case 'P': return lores_colors[3];
+        case 'B': return lores_colors[6];
+        case 'G': return lores_colors[12];
+        case 'O': return lores_colors[9];
+        default: return lores_colors[0];
+    }
+}
+
+int main(void) {
+    const int count = sizeof(patterns) / sizeof(patterns[0]);
+    crapple_build_hires_lines();
+    for (int i = 0; i < count; i++) {
+        MEMORY[hires_line_addresses[i] + patterns[i].col] = patterns[i].bytes[0];
+        MEMORY[hires_line_addresses[i] + patterns[i].col + 1] = patterns[i].bytes[1];
+    }
+    crapple_render_hires_page();
+    for (int y = 0; y < count; y++) {
+        const int first = patterns[y].col * 7;
+        for (int x = 0; x < WIDTH; x++) {
+            const bool in_pattern = x >= first && x < first + 14;
+            const uint32_t color = color_of(in_pattern ? patterns[y].colors[x - first] : 'K');
+            if (pixels[y * WIDTH + x] != color) {
+                fprintf(stderr, "Pixel %d of line %d is %08X, not %08X\n", x, y, pixels[y * WIDTH + x], color);
+                return 1;
+            }
+        }
+    }
+
+    srand(6502);
+    for (int i = HIRES_PAGE1_START; i < HIRES_PAGE1_START + HIRES_PAGE_SIZE; i++) {
+        MEMORY[i] = rand();
+    }
+    const double start = seconds();
+    for (int frame = 0; frame < FRAMES; frame++) {
+        hires_shadow.valid = false;
+        crapple_render_hires_page();
+    }
+    printf("%.0f ns per hi-res frame\n", (seconds() - start) / FRAMES * 1e9);
+    return 0;
+}
@@ -0,0 +1,74 @@
+//
+//  ptrget_bench.c
+//
+//  Cost of finding a simple variable with and without the hashed index in applesoft.c,
+//  as the number of variables grows from 10 to 800. The ROM's linear scan from $E053 is
+//  interpreted until it reaches the variable, then the same random names are looked up
+//  through the trap. Per table size it prints the scan's average cycles, the host time
+//  of each way, and their ratio; the native lookup is always charged
+//  APPLESOFT_FIND_CYCLES.
+//
+
+#include "../MCS6502.c"
+#include "../applesoft.c"
+#include "tools.h"
+
+#define LOOKUPS 20000
+
+static uint8_t memory[0x10000];
+
+// Points VARNAM at a random one of the variables
+static void pick_name(const uint16_t vartab, const int count) {
+    const uint16_t variable = vartab + 7 * (rand() % count);
+    memory[AS_VARNAM] = memory[variable];
+    memory[AS_VARNAM + 1] = memory[variable + 1];
+}
+
+int main(void) {
+    static const int counts[] = {10, 25, 50, 100, 200, 400, 800};
+    memcpy(&memory[0xD000], FP_BASIC_ROM, sizeof(FP_BASIC_ROM));
+    const uint16_t vartab = 0x0900;
+    memory[AS_VARTAB] = (uint8_t)vartab;
+    memory[AS_VARTAB + 1] = vartab >> 8;
+
+    printf("variables   ROM cycles   ROM ns   native ns   speedup\n");
+    for (size_t i = 0; i < sizeof(counts) / sizeof(counts[0]); i++) {
+        const int count = counts[i];
+        for (int v = 0; v < count; v++) { // Names A0..Z9, then AA..ZZ, all different
+            memory[vartab + 7 * v] = 'A' + v % 26;
+            memory[vartab + 7 * v + 1] = v < 260 ? '0' + v / 26 : 'A' + (v - 260) / 26;
+        }
+        const uint16_t arytab = vartab + 7 * count;
+        memory[AS_ARYTAB] = memory[AS_STREND] = arytab;
+        memory[AS_ARYTAB + 1] = memory[AS_STREND + 1] = arytab >> 8;
+
+        MCS6502ExecutionContext cpu;
+        MCS6502Init(&cpu, flat_read, flat_write, memory);
+        srand(6502);
+        long cycles = 0;
+        double start = seconds();
+        for (int lookup = 0; lookup < LOOKUPS; lookup++) {
+            pick_name(vartab, count);
+            cpu.pc = APPLESOFT_FIND_VARIABLE;
+            while (cpu.pc != 0xE0DE && cpu.pc != 0xE087) {
+                MCS6502ExecNext(&cpu);
+                cycles += cpu.timingForLastOperation;
+            }
+        }
+        const double rom = (seconds() - start) / LOOKUPS;
+
+        variable_index.built = false;
+        srand(6502);
+        start = seconds();
+        for (int lookup = 0; lookup < LOOKUPS; lookup++) {
+            pick_name(vartab, count);
+            cpu.pc = APPLESOFT_FIND_VARIABLE;
+            applesoft_variable_trap(&cpu, INT_MAX, memory);
+        }
+        const double native = (seconds() - start) / LOOKUPS;
+
+        printf("%9d   %10ld   %6.0f   %9.0f   %6.1fx\n", count, cycles / LOOKUPS, rom * 1e9, native * 1e9,
+               rom / native);
+    }
+    return 0;
+}
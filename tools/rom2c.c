@@ -0,0 +1,275 @@
+//
+//  rom2c.c
+//
+//  Translates the built-in ROMs (res/fp_basic.h and res/int_basic.h) into C ahead of
+//  time. Run by the translate_roms CMake target as `rom2c <output.h>`.
+//
+//  Code is found by following the flow from the reset/NMI/IRQ vectors and from every
+//  word in the ROM that looks like an address in it, or an address minus one for the
+//  RTS-dispatched command tables. A wrong guess costs code size, never correctness:
+//  translated code is only ever entered at the address it was decoded from, and the
+//  ROM is checked byte for byte before the translation is installed.
+//
+//  Each 256-byte page becomes one MCS6502TranslatedPageFunction that calls the same
+//  per-opcode handlers the interpreter uses, so cycle counts are exact. Branches and
+//  jumps within the page are gotos, anything else (computed jumps, returns, leaving
+//  the page) goes back through a switch on the PC and out to the interpreter when
+//  there is no code for it.
+//
+
+#include "../MCS6502.c"
+#include "../res/fp_basic.h"
+#include "../res/int_basic.h"
+
+#define ROM_BASE 0xD000
+#define ROM_SIZE 0x3000
+
+typedef struct {
+    const char* name; // C identifier
+    const char* image_name;
+    const uint8_t* image;
+    size_t size;
+} rom_info;
+
+static const rom_info roms[] = {
+    {"fp_basic", "FP_BASIC_ROM", FP_BASIC_ROM, sizeof(FP_BASIC_ROM)},
+    {"int_basic", "INT_BASIC_ROM", INT_BASIC_ROM, sizeof(INT_BASIC_ROM)},
+};
+
+static bool is_code[ROM_SIZE]; // Instruction starts to translate
+static uint16_t work[ROM_SIZE * 4];
+static int work_count;
+
+static bool in_rom(unsigned int address) {
+    return address >= ROM_BASE && address < ROM_BASE + ROM_SIZE;
+}
+
+static void add_entry(unsigned int address) {
+    if (in_rom(address) && !is_code[address - ROM_BASE] && work_count < (int) (sizeof(work) / sizeof(work[0]))) {
+        work[work_count++] = address;
+    }
+}
+
+static uint16_t operand_at(const uint8_t* image, unsigned int address, int length) {
+    unsigned int offset = address - ROM_BASE;
+    if (length == 3) {
+        return image[offset + 1] | (image[offset + 2] << 8);
+    }
+    return length == 2 ? image[offset + 1] : 0;
+}
+
+/**
+ * Follows straight-line code from each queued entry point, queueing branch, jump and
+ * call targets (and the return address after a call) as it goes.
+ */
+static void trace_code(const uint8_t* image) {
+    while (work_count > 0) {
+        unsigned int address = work[--work_count];
+        while (in_rom(address) && !is_code[address - ROM_BASE]) {
+            uint8 opcode = image[address - ROM_BASE];
+            const MCS6502OpcodeEntry* entry = &MCS6502HandlerTable[opcode];
+            // Instructions that straddle a page, or run off the ROM, are left to the interpreter.
+            if (!entry->handler || (address & 0xFF) + entry->length > 0x100 ||
+                !in_rom(address + entry->length - 1)) {
+                break;
+            }
+            is_code[address - ROM_BASE] = true;
+            uint16_t operand = operand_at(image, address, entry->length);
+            if ((opcode & 0x1F) == 0x10) {
+                add_entry((uint16_t) (address + 2 + (int8_t) operand));
+            } else if (opcode == 0x20) {
+                add_entry(operand);
+                add_entry(address + 3);
+            } else if (opcode == 0x4C) {
+                add_entry(operand);
+            }
+            if (OpcodeEndsBlock(opcode)) {
+                break;
+            }
+            address += entry->length;
+        }
+    }
+}
+
+static void find_code(const uint8_t* image) {
+    memset(is_code, 0, sizeof(is_code));
+    work_count = 0;
+    for (unsigned int vector = 0xFFFA; vector < 0x10000; vector += 2) {
+        add_entry(image[vector - ROM_BASE] | (image[vector - ROM_BASE + 1] << 8));
+    }
+    trace_code(image);
+    for (unsigned int offset = 0; offset + 1 < ROM_SIZE; offset++) {
+        unsigned int word = image[offset] | (image[offset + 1] << 8);
+        add_entry(word);
+        add_entry(word + 1);
+        trace_code(image);
+    }
+}
+
+static void print_instruction_comment(FILE* out, const uint8_t* image, unsigned int address) {
+    const MCS6502Instruction* instruction = MCS6502OpcodeTable[image[address - ROM_BASE]];
+    int length = MCS6502HandlerTable[instruction->opcode].length;
+    fprintf(out, "L_%04X: // %s", address, instruction->mnemonic);
+    if (instruction->mode == MCS6502AddressingRelative) {
+        fprintf(out, " $%04X", (uint16_t) (address + 2 + (int8_t) operand_at(image, address, 2)));
+    } else if (length == 2) {
+        fprintf(out, " $%02X", operand_at(image, address, 2));
+    } else if (length == 3) {
+        fprintf(out, " $%04X", operand_at(image, address, 3));
+    }
+    fprintf(out, "\n");
+}
+
+static bool page_has_code(unsigned int page) {
+    for (unsigned int address = page << 8; address < (page << 8) + 0x100; address++) {
+        if (is_code[address - ROM_BASE]) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static void translate_page(FILE* out, const rom_info* rom, unsigned int page) {
+    const uint8_t* image = rom->image;
+    unsigned int first = page << 8;
+
+    fprintf(out, "static bool translated_%s_page_%02X(MCS6502ExecutionContext* context, int cycleBudget,\n"
+                 "                                     unsigned int generation) {\n", rom->name, page);
+    fprintf(out, "    context->pendingTiming = 0;\n");
+    fprintf(out, "    context->timingForLastOperation = 0;\n");
+    bool dispatches = false; // Only jumps, calls and returns go back through the switch
+    for (unsigned int address = first; address < first + 0x100; address++) {
+        uint8 opcode = image[address - ROM_BASE];
+        if (is_code[address - ROM_BASE] && OpcodeEndsBlock(opcode) && (opcode & 0x1F) != 0x10) {
+            dispatches = true;
+        }
+    }
+    if (dispatches) {
+        fprintf(out, "dispatch:\n");
+    }
+    fprintf(out, "    switch (context->pc) {\n");
+    for (unsigned int address = first; address < first + 0x100; address++) {
+        if (is_code[address - ROM_BASE]) {
+            fprintf(out, "        case 0x%04X: goto L_%04X;\n", address, address);
+        }
+    }
+    fprintf(out, "        default: return context->timingForLastOperation != 0; // Nothing run yet, no code here\n");
+    fprintf(out, "    }\n\n");
+
+    for (unsigned int address = first; address < first + 0x100; address++) {
+        if (!is_code[address - ROM_BASE]) {
+            continue;
+        }
+        uint8 opcode = image[address - ROM_BASE];
+        int length = MCS6502HandlerTable[opcode].length;
+        uint16_t operand = operand_at(image, address, length);
+        unsigned int next = address + length;
+
+        print_instruction_comment(out, image, address);
+        fprintf(out, "    MCS6502Handler_0x%02X(context, 0x%04X);\n", opcode, operand);
+        fprintf(out, "    TRANSLATED_EXIT_CHECK(0x%02X);\n", page);
+        if ((opcode & 0x1F) == 0x10) {
+            unsigned int target = (uint16_t) (address + 2 + (int8_t) operand);
+            if (target >> 8 == page && is_code[target - ROM_BASE]) {
+                fprintf(out, "    if (context->pc == 0x%04X) goto L_%04X;\n", target, target);
+            } else {
+                fprintf(out, "    if (context->pc != 0x%04X) return true;\n", next);
+            }
+        } else if (OpcodeEndsBlock(opcode)) {
+            fprintf(out, "    goto dispatch;\n");
+            continue;
+        }
+
+        // Fall through to the next instruction
+        bool next_is_code = next >> 8 == page && is_code[next - ROM_BASE];
+        unsigned int following = address + 1;
+        while (following < first + 0x100 && !is_code[following - ROM_BASE]) {
+            following++;
+        }
+        if (!next_is_code) {
+            fprintf(out, "    return true;\n");
+        } else if (following != next) {
+            fprintf(out, "    goto L_%04X;\n", next);
+        }
+    }
+    fprintf(out, "}\n\n");
+}
+
+static void translate_rom(FILE* out, const rom_info* rom) {
+    find_code(rom->image);
+
+    int count = 0;
+    for (unsigned int offset = 0; offset < ROM_SIZE; offset++) {
+        count += is_code[offset];
+    }
+    fprintf(out, "//\n// %s: %d instructions\n//\n\n", rom->image_name, count);
+
+    for (unsigned int page = ROM_BASE >> 8; page < 0x100; page++) {
+        if (page_has_code(page)) {
+            translate_page(out, rom, page);
+        }
+    }
+
+    fprintf(out, "static void translated_%s_install(MCS6502ExecutionContext* context) {\n", rom->name);
+    for (unsigned int page = ROM_BASE >> 8; page < 0x100; page++) {
+        if (page_has_code(page)) {
+            fprintf(out, "    MCS6502SetTranslatedPage(context, 0x%02X, translated_%s_page_%02X);\n", page, rom->name, page);
+        }
+    }
+    fprintf(out, "}\n\n");
+}
+
+int main(int argc, char** argv) {
+    if (argc != 2) {
+        fprintf(stderr, "usage: %s <output.h>\n", argv[0]);
+        return 1;
+    }
+    FILE* out = fopen(argv[1], "w");
+    if (!out) {
+        fprintf(stderr, "Can't write %s\n", argv[1]);
+        return 1;
+    }
+    MCS6502Init(&(MCS6502ExecutionContext){0}, NULL, NULL, NULL); // Builds MCS6502OpcodeTable
+
+    fprintf(out, "// Generated by tools/rom2c.c from res/fp_basic.h and res/int_basic.h, do not edit.\n");
+    fprintf(out, "// Include after MCS6502.c, whose handlers it calls, then call translated_roms_install().\n\n");
+    fprintf(out, "#pragma once\n\n");
+    fprintf(out, "// Leaves the translated code on anything that would end a cached block early\n");
+    fprintf(out, "#define TRANSLATED_EXIT_CHECK(page) \\\n");
+    fprintf(out, "    if (context->stopRequested || (int) context->timingForLastOperation >= cycleBudget || \\\n");
+    fprintf(out, "        context->pageWriteGenerations[page] != generation) { return true; }\n\n");
+    fprintf(out, "// The translation is only good for a byte for byte identical ROM.\n");
+    fprintf(out, "static bool translated_rom_matches(MCS6502ExecutionContext* context, const uint8_t* image) {\n");
+    fprintf(out, "    for (int page = 0x%02X; page < 0x100; page++) {\n", ROM_BASE >> 8);
+    fprintf(out, "        const uint8* mapped = context->readPages[page];\n");
+    fprintf(out, "        if (!mapped || memcmp(mapped, image + ((page - 0x%02X) << 8), 0x100) != 0) {\n", ROM_BASE >> 8);
+    fprintf(out, "            return false;\n");
+    fprintf(out, "        }\n");
+    fprintf(out, "    }\n");
+    fprintf(out, "    return true;\n");
+    fprintf(out, "}\n\n");
+
+    for (size_t i = 0; i < sizeof(roms) / sizeof(roms[0]); i++) {
+        if (roms[i].size != ROM_SIZE) {
+            fprintf(stderr, "%s is %zu bytes, expected %d\n", roms[i].image_name, roms[i].size, ROM_SIZE);
+            return 1;
+        }
+        translate_rom(out, &roms[i]);
+    }
+
+    fprintf(out, "/**\n"
+                 " * Installs the translation of whichever built-in ROM is mapped at $D000-$FFFF, if any,\n"
+                 " * and returns its name. Needs the block cache.\n"
+                 " */\n");
+    fprintf(out, "static const char* translated_roms_install(MCS6502ExecutionContext* context) {\n");
+    for (size_t i = 0; i < sizeof(roms) / sizeof(roms[0]); i++) {
+        fprintf(out, "    if (translated_rom_matches(context, %s)) {\n", roms[i].image_name);
+        fprintf(out, "        translated_%s_install(context);\n", roms[i].name);
+        fprintf(out, "        return \"%s\";\n", roms[i].image_name);
+        fprintf(out, "    }\n");
+    }
+    fprintf(out, "    return NULL;\n");
+    fprintf(out, "}\n");
+    fclose(out);
+    return 0;
+}
@@ -0,0 +1,134 @@
+//
+//  text_bench.c
+//
+//  The text page renderer draws each row of a character by copying a line of a glyph
+//  tile built from FONT ahead of time. This checks it against the original renderer,
+//  kept here as the reference, which tests every pixel of the font for every cell: on
+//  a page of random screen codes and a random font, in both phases of flashing, and
+//  then after each of a run of random writes to the page and flips of flashing. It also
+//  times a full frame each way, and a frame where nothing on the page was written.
+//
+
+#include "../crapple.c"
+#include "tools.h"
+
+#define FRAMES 20000
+#define CHANGES 2000
+
+// The renderer text tiles replaced, a pixel of the font at a time
+static void render_text_page_by_pixel(void) {
+    for (int row = 0; row < 24; row++) {
+        for (int col = 0; col < 40; col++) {
+            uint8_t chr = MEMORY[row_start_addresses[row] + col];
+            uint8_t glyph_idx = chr;
+            uint32_t fg_color = 0xFF00FF00; // Green (normal)
+            uint32_t bg_color = 0xFF000000; // Black (background)
+
+            // Handle character modes
+            if (chr >= 0x00 && chr <= 0x3F) {
+                // Inverse
+                glyph_idx = chr | 0x40; // Map to normal glyph
+                fg_color = 0xFF000000; // Black foreground
+                bg_color = 0xFF00FF00; // Green background
+            }
+            else if (chr >= 0x40 && chr <= 0x7F) {
+                // Flashing
+                glyph_idx = chr & 0x3F; // Base glyph
+                if (flash_on) {
+                    fg_color = 0xFF000000; // Black foreground (inverse)
+                    bg_color = 0xFF00FF00; // Green background
+                }
+                else {
+                    fg_color = 0xFF00FF00; // Green foreground (normal)
+                    bg_color = 0xFF000000; // Black background
+                }
+            }
+            else {
+                // Normal (0x80-0xFF)
+                glyph_idx = chr & 0x7F; // Strip high bit
+            }
+
+            for (int y = 0; y < 8; y++) {
+                uint8_t glyphRow = FONT[glyph_idx][y];
+                for (int x = 0; x < 7; x++) {
+                    int px = col * 7 + x;
+                    int py = row * 8 + y;
+                    pixels[py * WIDTH + px] = (glyphRow & (1 << (6 - x))) ? fg_color : bg_color;
+                }
+            }
+        }
+    }
+}
+
+static uint32_t expected[WIDTH * HEIGHT];
+
+// Whether pixels are what render_text_page_by_pixel draws
+static bool pixels_as_expected(void) {
+    static uint32_t drawn[WIDTH * HEIGHT];
+    memcpy(drawn, pixels, sizeof(pixels));
+    render_text_page_by_pixel();
+    memcpy(expected, pixels, sizeof(pixels));
+    memcpy(pixels, drawn, sizeof(pixels));
+    return memcmp(expected, drawn, sizeof(pixels)) == 0;
+}
+
+int main(void) {
+    srand(6502);
+    for (int i = 0; i < 256 * 8; i++) {
+        FONT[i / 8][i % 8] = rand();
+    }
+    for (int i = TEXT_PAGE1_START; i < TEXT_PAGE1_START + 0x400; i++) {
+        MEMORY[i] = rand();
+    }
+    crapple_build_text_glyphs(TEXT_FOREGROUND, TEXT_BACKGROUND);
+
+    printf("flash   per pixel ns   glyph tiles ns   speedup   unwritten ns\n");
+    for (int flash = 0; flash < 2; flash++) {
+        flash_on = flash;
+        memset(pixels, 0, sizeof(pixels));
+        text_shadow.valid = false;
+        crapple_render_text_page();
+        if (!pixels_as_expected()) {
+            fprintf(stderr, "Glyph tiles drew different pixels with flash_on %d\n", flash);
+            return 1;
+        }
+
+        double start = seconds();
+        for (int frame = 0; frame < FRAMES; frame++) {
+            render_text_page_by_pixel();
+        }
+        const double before = (seconds() - start) / FRAMES;
+        start = seconds();
+        for (int frame = 0; frame < FRAMES; frame++) {
+            text_shadow.valid = false;
+            crapple_render_text_page();
+        }
+        const double after = (seconds() - start) / FRAMES;
+        start = seconds();
+        for (int frame = 0; frame < FRAMES; frame++) {
+            crapple_render_text_page();
+        }
+        const double unwritten = (seconds() - start) / FRAMES;
+
+        printf("%5d   %12.0f   %14.0f   %6.1fx   %12.0f\n", flash, before * 1e9, after * 1e9, before / after,
+               unwritten * 1e9);
+    }
+
+    // A few characters changed at a time, and now and then a flip of flashing
+    for (int change = 0; change < CHANGES; change++) {
+        for (int i = rand() % 4; i > 0; i--) {
+            const uint16_t address = row_start_addresses[rand() % TEXT_ROWS] + rand() % 40;
+            MEMORY[address] = rand();
+            MCS6502InvalidatePages(&context, address >> 8, 1);
+        }
+        if (rand() % 8 == 0) {
+            flash_on = !flash_on;
+        }
+        crapple_render_text_page();
+        if (!pixels_as_expected()) {
+            fprintf(stderr, "Glyph tiles drew different pixels after %d changes\n", change);
+            return 1;
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,20 @@
+//
+//  tools.h
+//
+//  Shared by the checks and benchmarks in this directory: a 6502 bus over a flat 64K
+//  array, handed to MCS6502Init as the read/write context, and a clock to time with.
+//
+
+#pragma once
+#include <time.h>
+#include "../MCS6502.h"
+
+static inline uint8 flat_read(uint16 address, void* memory) { return ((uint8*) memory)[address]; }
+static inline void flat_write(uint16 address, uint8 value, void* memory) { ((uint8*) memory)[address] = value; }
+
+// Seconds since some fixed point, unaffected by changes to the system time
+static inline double seconds(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+}